@@ -2,177 +2,4818 @@
 #include <fstream>
 #include <sstream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <algorithm>
 #include <optional>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <set>
+#include <map>
 #include <cstdint>
+#include <charconv>
 #include <stdexcept>
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <random>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <filesystem>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define ROUTER_X86_SIMD 1
+#else
+#define ROUTER_X86_SIMD 0
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define ROUTER_MMAP 1
+#else
+#define ROUTER_MMAP 0
+#endif
 
 using namespace std;
 
 // ------------------------- Utilities -------------------------
+// Funkcja generująca maskę sieciową na podstawie prefiksu
+uint32_t maskFromPrefix(int prefix) {
+    if (prefix < 0 || prefix > 32)
+        throw invalid_argument("Nieprawidłowa długość prefiksu. Dozwolony zakres: 0-32.");
+    return prefix == 0 ? 0 : (0xFFFFFFFF << (32 - prefix));
+}
+
+// Maska bez walidacji - dla struktur wyszukiwania, które same pilnują zakresu 0-32
+inline uint32_t prefixMask(int prefix) {
+    return prefix == 0 ? 0 : (0xFFFFFFFFu << (32 - prefix));
+}
+
+// Wczytuje opcjonalny argument polecenia; przy jego braku zostawia wartość domyślną
+template <class T>
+void readOptional(istream& in, T& value) {
+    T parsed;
+    if (in >> parsed) value = parsed;
+}
+
+// Czas w sekundach od podanej chwili - do pomiarów wydajności
+inline double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Wartość oznaczająca brak dopasowania w strukturach wyszukiwania
+constexpr uint32_t NO_ROUTE = 0xFFFFFFFF;
+
+// Liczba wyszukiwań przeplatanych w wersjach wsadowych - tyle chybień w pamięci podręcznej
+// może być obsługiwanych równocześnie
+constexpr size_t BATCH_LANES = 16;
+
+// Plik tylko do odczytu zmapowany w pamięci (mmap); bez mmap wczytywany w całości.
+// Z prefault strony są wczytywane od razu (do przetwarzania całego pliku), bez niego -
+// dopiero przy pierwszym dostępie, a niezmienione strony są współdzielone między procesami.
+class MappedFile {
+    const char* bytes = nullptr;
+    size_t length = 0;
+    string copy;
+#if ROUTER_MMAP
+    void* mapping = nullptr;
+#endif
+
+public:
+    explicit MappedFile(const string& path, bool prefault = true) {
+#if ROUTER_MMAP
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw runtime_error("Nie można otworzyć pliku: " + path);
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            ::close(fd);
+            throw runtime_error("Nie można odczytać rozmiaru pliku: " + path);
+        }
+        length = static_cast<size_t>(info.st_size);
+        if (length > 0) {
+            int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+            if (prefault) flags |= MAP_POPULATE;
+#endif
+            mapping = mmap(nullptr, length, PROT_READ, flags, fd, 0);
+            if (mapping == MAP_FAILED) {
+                ::close(fd);
+                throw runtime_error("Nie można zmapować pliku: " + path);
+            }
+            if (prefault) madvise(mapping, length, MADV_WILLNEED);
+            bytes = static_cast<const char*>(mapping);
+        }
+        ::close(fd);
+#else
+        (void)prefault;
+        ifstream in(path, ios::binary);
+        if (!in)
+            throw runtime_error("Nie można otworzyć pliku: " + path);
+        copy.assign(istreambuf_iterator<char>(in), istreambuf_iterator<char>());
+        bytes = copy.data();
+        length = copy.size();
+#endif
+    }
+
+    ~MappedFile() {
+#if ROUTER_MMAP
+        if (mapping) munmap(mapping, length);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    string_view view() const { return string_view(bytes, length); }
+    const char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+// ------------------------- SIMD -------------------------
+// Wybór wektorowych wersji wyszukiwania wsadowego w czasie działania, zależnie od procesora.
+// Wersja skalarna daje zawsze identyczne wyniki i jest używana poza x86.
+enum class SimdLevel { Scalar, Avx2, Avx512 };
+
+inline SimdLevel detectSimdLevel() {
+#if ROUTER_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return SimdLevel::Avx512;
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::Avx2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+inline atomic<SimdLevel>& activeSimdLevel() {
+    static atomic<SimdLevel> level(detectSimdLevel());
+    return level;
+}
+
+inline const char* simdLevelName(SimdLevel level) {
+    switch (level) {
+        case SimdLevel::Avx512: return "avx512";
+        case SimdLevel::Avx2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+// Ogranicza poziom SIMD (np. do porównań); nie pozwala wybrać poziomu nieobsługiwanego przez procesor
+inline void setSimdLevel(const string& name) {
+    SimdLevel level;
+    if (name == "scalar") level = SimdLevel::Scalar;
+    else if (name == "avx2") level = SimdLevel::Avx2;
+    else if (name == "avx512") level = SimdLevel::Avx512;
+    else throw invalid_argument("Nieznany poziom SIMD: " + name + ". Dostępne: scalar, avx2, avx512.");
+
+    if (level > detectSimdLevel())
+        throw invalid_argument(string("Procesor nie obsługuje ") + name + ".");
+    activeSimdLevel() = level;
+}
+
+// ------------------------- Parser adresów -------------------------
+// Błędy parsowania adresów - parser ich nie zgłasza jako wyjątków, żeby nadawał się do
+// wczytywania dużych plików, gdzie błędny wiersz jest zwykłą sytuacją
+enum class ParseError {
+    None,
+    Empty,
+    BadCharacter,
+    OctetCount,     // inna liczba oktetów niż 4
+    OctetRange,     // oktet większy niż 255 lub dłuższy niż 3 cyfry
+    PrefixRange,    // prefiks spoza 0-32 lub bez cyfr
+    FieldCount,     // wiersz pliku tras bez sieci, bramy i metryki
+    BadMetric,
+};
+
+inline const char* parseErrorMessage(ParseError error) {
+    switch (error) {
+        case ParseError::None: return "brak błędu";
+        case ParseError::Empty: return "pusty adres";
+        case ParseError::BadCharacter: return "niedozwolony znak";
+        case ParseError::OctetCount: return "adres musi mieć 4 oktety";
+        case ParseError::OctetRange: return "oktet spoza zakresu 0-255";
+        case ParseError::PrefixRange: return "prefiks spoza zakresu 0-32";
+        case ParseError::FieldCount: return "oczekiwano: <sieć> <brama> <metryka>";
+        case ParseError::BadMetric: return "nieprawidłowa metryka";
+    }
+    return "nieznany błąd";
+}
+
+// Parser adresu "a.b.c.d" bez alokacji: jeden przebieg po znakach, oktety sprawdzane
+// na bieżąco. Przy błędzie 'out' pozostaje niezmieniony.
+inline ParseError parseIPv4Scalar(string_view text, uint32_t& out) {
+    if (text.empty())
+        return ParseError::Empty;
+    uint32_t addr = 0, octet = 0;
+    int octets = 0, digits = 0;
+    for (char c : text) {
+        unsigned d = static_cast<unsigned char>(c) - '0';
+        if (d < 10) {
+            octet = octet * 10 + d;
+            if (++digits > 3 || octet > 255)
+                return ParseError::OctetRange;
+        } else if (c == '.') {
+            if (digits == 0)
+                return ParseError::OctetCount;
+            if (++octets == 4)
+                return ParseError::OctetCount;
+            addr = (addr << 8) | octet;
+            octet = 0;
+            digits = 0;
+        } else {
+            return ParseError::BadCharacter;
+        }
+    }
+    if (digits == 0 || octets != 3)
+        return ParseError::OctetCount;
+    out = (addr << 8) | octet;
+    return ParseError::None;
+}
+
+#if ROUTER_X86_SIMD
+// Wersja wektorowa: pozycje kropek wyznaczają długości oktetów (po 1-3 cyfry, czyli 81 układów),
+// a każdy układ ma gotową maskę pshufb rozkładającą cyfry na setki/dziesiątki/jedności
+// w osobnych 32-bitowych polach. Wszystko, co nie jest poprawnym adresem, trafia do wersji
+// skalarnej, która zwraca dokładny kod błędu.
+struct IPv4ShuffleTable {
+    alignas(16) uint8_t patterns[81][16];
+
+    IPv4ShuffleTable() {
+        for (int index = 0; index < 81; ++index) {
+            int lengths[4] = {index / 27 + 1, index / 9 % 3 + 1, index / 3 % 3 + 1, index % 3 + 1};
+            int begin = 0;
+            for (int octet = 0; octet < 4; ++octet) {
+                uint8_t* lane = patterns[index] + 4 * octet;
+                int len = lengths[octet], last = begin + len - 1;
+                lane[0] = len >= 3 ? last - 2 : 0x80;
+                lane[1] = len >= 2 ? last - 1 : 0x80;
+                lane[2] = last;
+                lane[3] = 0x80;
+                begin += len + 1;
+            }
+        }
+    }
+};
+
+inline const IPv4ShuffleTable& ipv4Shuffles() {
+    static const IPv4ShuffleTable table;
+    return table;
+}
+
+// Czyta 16 bajtów naraz, więc od początku tekstu do 'limit' (końca bufora, w którym leży tekst)
+// musi ich być co najmniej tyle - inaczej adres trafia do wersji skalarnej.
+__attribute__((target("avx2,popcnt")))
+inline ParseError parseIPv4Simd(string_view text, uint32_t& out, const IPv4ShuffleTable& table, const char* limit) {
+    size_t len = text.size();
+    const char* data = text.data();
+    if (len < 7 || len > 15 || limit - data < 16)
+        return parseIPv4Scalar(text, out);
+    __m128i raw = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+
+    uint32_t inside = (1u << len) - 1;
+    __m128i digits = _mm_sub_epi8(raw, _mm_set1_epi8('0'));
+    uint32_t isDigit = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(digits, _mm_set1_epi8(9)), digits));
+    uint32_t dots = _mm_movemask_epi8(_mm_cmpeq_epi8(raw, _mm_set1_epi8('.'))) & inside;
+    if (((isDigit | dots) & inside) != inside || __builtin_popcount(dots) != 3)
+        return parseIPv4Scalar(text, out);
+
+    unsigned d0 = __builtin_ctz(dots);
+    dots &= dots - 1;
+    unsigned d1 = __builtin_ctz(dots);
+    dots &= dots - 1;
+    unsigned d2 = __builtin_ctz(dots);
+    unsigned l0 = d0 - 1, l1 = d1 - d0 - 2, l2 = d2 - d1 - 2, l3 = len - d2 - 2;  // długości minus 1
+    if (l0 > 2 || l1 > 2 || l2 > 2 || l3 > 2)
+        return parseIPv4Scalar(text, out);
+
+    __m128i pattern = _mm_load_si128(reinterpret_cast<const __m128i*>(table.patterns[l0 * 27 + l1 * 9 + l2 * 3 + l3]));
+    __m128i spread = _mm_shuffle_epi8(digits, pattern);
+    __m128i pairs = _mm_maddubs_epi16(spread, _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0, 100, 10, 1, 0));
+    __m128i octets = _mm_madd_epi16(pairs, _mm_set1_epi16(1));
+    if (_mm_movemask_epi8(_mm_cmpgt_epi32(octets, _mm_set1_epi32(255))))
+        return ParseError::OctetRange;
+
+    out = static_cast<uint32_t>(_mm_cvtsi128_si32(
+        _mm_shuffle_epi8(octets, _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1))));
+    return ParseError::None;
+}
+#endif
+
+// 'limit' to koniec bufora, z którego wolno czytać (domyślnie koniec tekstu). Wersja wektorowa
+// działa tylko na tekstach z co najmniej 16 dostępnymi bajtami, np. wierszach wczytanego pliku.
+inline ParseError parseIPv4(string_view text, uint32_t& out, const char* limit = nullptr) {
+#if ROUTER_X86_SIMD
+    if (activeSimdLevel().load(memory_order_relaxed) != SimdLevel::Scalar)
+        return parseIPv4Simd(text, out, ipv4Shuffles(), limit ? limit : text.data() + text.size());
+#else
+    (void)limit;
+#endif
+    return parseIPv4Scalar(text, out);
+}
+
+// Adres z opcjonalnym prefiksem "a.b.c.d/n"; bez prefiksu przyjmowane jest /32
+inline ParseError parseCidr(string_view text, uint32_t& addr, int& prefix, const char* limit = nullptr) {
+    size_t slash = text.find('/');
+    int len = 32;
+    if (slash != string_view::npos) {
+        string_view digits = text.substr(slash + 1);
+        if (digits.empty() || digits.size() > 2)
+            return ParseError::PrefixRange;
+        len = 0;
+        for (char c : digits) {
+            if (c < '0' || c > '9')
+                return ParseError::PrefixRange;
+            len = len * 10 + (c - '0');
+        }
+        if (len > 32)
+            return ParseError::PrefixRange;
+    }
+    uint32_t parsed;
+    ParseError error = parseIPv4(text.substr(0, slash), parsed, limit ? limit : text.data() + text.size());
+    if (error != ParseError::None)
+        return error;
+    addr = parsed;
+    prefix = len;
+    return ParseError::None;
+}
+
 // Konwersja adresu IP (w formacie "x.x.x.x") na liczbę 32-bitową
 uint32_t ipToUint(const string& ip) {
-    int parts[4];
-    if (sscanf(ip.c_str(), "%d.%d.%d.%d", &parts[0], &parts[1], &parts[2], &parts[3]) != 4) {
-        throw invalid_argument("Nieprawidłowy format adresu IP: " + ip + ". Poprawny przykład: 192.168.0.1");
+    uint32_t addr;
+    ParseError error = parseIPv4(ip, addr);
+    if (error != ParseError::None) {
+        throw invalid_argument("Nieprawidłowy format adresu IP: " + ip + " (" + parseErrorMessage(error)
+                               + "). Poprawny przykład: 192.168.0.1");
+    }
+    return addr;
+}
+
+// ------------------------- IPAddress -------------------------
+// Klasa reprezentująca adres IP
+class IPAddress {
+    uint32_t addr;
+    int prefix;
+public:
+    // Konstruktor z parametrem CIDR (adres IP + prefiks)
+    explicit IPAddress(const string& cidr) {
+        ParseError error = parseCidr(cidr, addr, prefix);
+        if (error == ParseError::PrefixRange)
+            throw invalid_argument("Nieprawidłowa długość prefiksu. Dozwolony zakres: 0-32.");
+        if (error != ParseError::None) {
+            throw invalid_argument("Nieprawidłowy format adresu IP: " + cidr + " (" + parseErrorMessage(error)
+                                   + "). Poprawny przykład: 192.168.0.1");
+        }
+        addr &= maskFromPrefix(prefix);
+    }
+
+    // Wersja bez wyjątków - do wczytywania plików
+    static ParseError parse(string_view cidr, IPAddress& out) {
+        uint32_t parsed;
+        int len;
+        ParseError error = parseCidr(cidr, parsed, len);
+        if (error == ParseError::None)
+            out = IPAddress(parsed, len);
+        return error;
+    }
+
+    // Konstruktor z adresu w postaci liczbowej i długości prefiksu
+    IPAddress(uint32_t address, int prefixLen)
+        : addr(address & maskFromPrefix(prefixLen)), prefix(prefixLen) {}
+
+    bool matches(const IPAddress& other) const {
+        uint32_t mask = maskFromPrefix(prefix);
+        return (other.addr & mask) == addr;
+    }
+
+    int getPrefix() const { return prefix; }
+    uint32_t getAddr() const { return addr; }
+
+    string toString() const {
+        ostringstream oss;
+        oss << ((addr >> 24) & 0xFF) << '.' << ((addr >> 16) & 0xFF) << '.' << ((addr >> 8) & 0xFF) << '.' << (addr & 0xFF) << '/' << prefix;
+        return oss.str();
+    }
+
+    bool operator==(const IPAddress& other) const {
+        return addr == other.addr && prefix == other.prefix;
     }
-    return (parts[0] << 24) | (parts[1] << 16) | (parts[2] << 8) | parts[3];
+};
+
+namespace std {
+    template <>
+    struct hash<IPAddress> {
+        // Mieszanie (finalizator splitmix64) pary adres/prefiks bez formatowania do tekstu
+        size_t operator()(const IPAddress& ip) const {
+            uint64_t x = (static_cast<uint64_t>(ip.getAddr()) << 8) | static_cast<uint8_t>(ip.getPrefix());
+            x ^= x >> 30;
+            x *= 0xBF58476D1CE4E5B9ull;
+            x ^= x >> 27;
+            x *= 0x94D049BB133111EBull;
+            x ^= x >> 31;
+            return static_cast<size_t>(x);
+        }
+    };
 }
 
-// Funkcja generująca maskę sieciową na podstawie prefiksu
-uint32_t maskFromPrefix(int prefix) {
-    if (prefix < 0 || prefix > 32)
-        throw invalid_argument("Nieprawidłowa długość prefiksu. Dozwolony zakres: 0-32.");
-    return prefix == 0 ? 0 : (0xFFFFFFFF << (32 - prefix));
-}
+// ------------------------- Route -------------------------
+// Klasa reprezentująca trasę w tablicy routingu
+class Route {
+    IPAddress network;
+    IPAddress gateway;
+    IPAddress nextHop;      // bezpośrednio osiągalny adres, przez który faktycznie prowadzi brama
+    int metric;
+public:
+    Route(const IPAddress& net, const IPAddress& gw, int met)
+        : network(net), gateway(gw), nextHop(gw), metric(met) {}
+
+    Route(const IPAddress& net, const IPAddress& gw, int met, const IPAddress& hop)
+        : network(net), gateway(gw), nextHop(hop), metric(met) {}
+
+    const IPAddress& getNetwork() const { return network; }
+    const IPAddress& getGateway() const { return gateway; }
+    const IPAddress& getNextHop() const { return nextHop; }
+    int getMetric() const { return metric; }
+
+    bool matches(const IPAddress& addr) const {
+        return network.matches(addr);
+    }
+
+    string toString() const {
+        ostringstream oss;
+        oss << "Sieć: " << network.toString()
+            << ", Brama: " << gateway.toString();
+        if (!(nextHop == gateway))
+            oss << " (przez " << nextHop.toString() << ")";
+        oss << ", Metryka: " << metric;
+        return oss.str();
+    }
+};
+
+// ------------------------- PatriciaTrie -------------------------
+// Skompresowane drzewo binarne (Patricia) do wyszukiwania najdłuższego pasującego prefiksu.
+// Każdy węzeł przechowuje pełny prefiks, więc wyszukiwanie schodzi co najwyżej 33 poziomy
+// niezależnie od liczby tras. Węzły leżą w wektorze i są adresowane indeksami.
+class PatriciaTrie {
+    static constexpr uint32_t NIL = 0xFFFFFFFF;
+
+    struct Node {
+        uint32_t key;       // zamaskowane bity prefiksu
+        uint32_t value;     // NO_ROUTE dla węzłów pośrednich
+        uint32_t child[2];
+        uint8_t len;
+    };
+
+    vector<Node> nodes;
+    vector<uint32_t> freeNodes;
+    uint32_t root = NIL;
+    size_t count = 0;
+
+    static int bitAt(uint32_t key, int pos) {
+        return (key >> (31 - pos)) & 1;
+    }
+
+    static int commonLength(uint32_t a, int alen, uint32_t b, int blen) {
+        uint32_t diff = a ^ b;
+        int common = diff ? __builtin_clz(diff) : 32;
+        return min(common, min(alen, blen));
+    }
+
+    uint32_t newNode(uint32_t key, int len, uint32_t value) {
+        Node node{key, value, {NIL, NIL}, static_cast<uint8_t>(len)};
+        if (!freeNodes.empty()) {
+            uint32_t n = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[n] = node;
+            return n;
+        }
+        nodes.push_back(node);
+        return static_cast<uint32_t>(nodes.size() - 1);
+    }
+
+    void setLink(uint32_t parent, int side, uint32_t n) {
+        if (parent == NIL) root = n;
+        else nodes[parent].child[side] = n;
+    }
+
+    // Usuwa węzeł bez wartości, jeśli ma co najwyżej jedno dziecko
+    bool splice(uint32_t n, uint32_t parent, int side) {
+        Node& node = nodes[n];
+        if (node.value != NO_ROUTE || (node.child[0] != NIL && node.child[1] != NIL))
+            return false;
+        setLink(parent, side, node.child[0] != NIL ? node.child[0] : node.child[1]);
+        freeNodes.push_back(n);
+        return true;
+    }
+
+public:
+    void insert(uint32_t key, int len, uint32_t value) {
+        key &= prefixMask(len);
+        uint32_t parent = NIL;
+        int side = 0;
+        uint32_t n = root;
+
+        while (n != NIL) {
+            uint32_t nkey = nodes[n].key;
+            int nlen = nodes[n].len;
+            int common = commonLength(key, len, nkey, nlen);
+
+            if (common == nlen) {
+                if (len == nlen) {
+                    if (nodes[n].value == NO_ROUTE) ++count;
+                    nodes[n].value = value;
+                    return;
+                }
+                parent = n;
+                side = bitAt(key, nlen);
+                n = nodes[n].child[side];
+                continue;
+            }
+
+            // Nowy prefiks rozgałęzia się przed węzłem n
+            uint32_t split;
+            if (common == len) {
+                split = newNode(key, len, value);
+            } else {
+                split = newNode(key & prefixMask(common), common, NO_ROUTE);
+                uint32_t leaf = newNode(key, len, value);
+                nodes[split].child[bitAt(key, common)] = leaf;
+            }
+            nodes[split].child[bitAt(nkey, common)] = n;
+            setLink(parent, side, split);
+            ++count;
+            return;
+        }
+
+        setLink(parent, side, newNode(key, len, value));
+        ++count;
+    }
+
+    bool erase(uint32_t key, int len) {
+        key &= prefixMask(len);
+        uint32_t path[34];
+        int sides[34];
+        int depth = 0;
+        uint32_t parent = NIL;
+        int side = 0;
+        uint32_t n = root;
+
+        while (n != NIL && nodes[n].len < len) {
+            if ((key & prefixMask(nodes[n].len)) != nodes[n].key)
+                return false;
+            path[depth] = parent;
+            sides[depth++] = side;
+            parent = n;
+            side = bitAt(key, nodes[n].len);
+            n = nodes[n].child[side];
+        }
+        if (n == NIL || nodes[n].len != len || nodes[n].key != key || nodes[n].value == NO_ROUTE)
+            return false;
+
+        nodes[n].value = NO_ROUTE;
+        --count;
+        // Węzeł bez wartości może pociągnąć za sobą zbędny węzeł pośredni rodzica
+        if (splice(n, parent, side) && parent != NIL)
+            splice(parent, path[depth - 1], sides[depth - 1]);
+        return true;
+    }
+
+    uint32_t lookup(uint32_t addr) const {
+        uint32_t best = NO_ROUTE;
+        uint32_t n = root;
+        while (n != NIL) {
+            const Node& node = nodes[n];
+            if ((addr & prefixMask(node.len)) != node.key) break;
+            if (node.value != NO_ROUTE) best = node.value;
+            if (node.len == 32) break;
+            n = node.child[bitAt(addr, node.len)];
+        }
+        return best;
+    }
+
+    // Wyszukiwania z partii schodzą po drzewie równolegle, po jednym poziomie na przebieg,
+    // a następny węzeł każdego z nich jest pobierany z wyprzedzeniem
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const {
+        uint32_t cur[BATCH_LANES];
+        for (size_t base = 0; base < n; base += BATCH_LANES) {
+            size_t lanes = min(BATCH_LANES, n - base);
+            for (size_t i = 0; i < lanes; ++i) {
+                cur[i] = root;
+                out[base + i] = NO_ROUTE;
+            }
+
+            bool active = root != NIL;
+            while (active) {
+                active = false;
+                for (size_t i = 0; i < lanes; ++i) {
+                    if (cur[i] == NIL) continue;
+                    const Node& node = nodes[cur[i]];
+                    uint32_t addr = addrs[base + i];
+                    if ((addr & prefixMask(node.len)) != node.key) {
+                        cur[i] = NIL;
+                        continue;
+                    }
+                    if (node.value != NO_ROUTE) out[base + i] = node.value;
+                    cur[i] = node.len == 32 ? NIL : node.child[bitAt(addr, node.len)];
+                    if (cur[i] != NIL) {
+                        __builtin_prefetch(&nodes[cur[i]]);
+                        active = true;
+                    }
+                }
+            }
+        }
+    }
+
+    // Najdłuższy pasujący prefiks nie dłuższy niż maxLen; długość zwracana przez foundLen
+    uint32_t lookupCovering(uint32_t addr, int maxLen, int& foundLen) const {
+        uint32_t best = NO_ROUTE;
+        foundLen = -1;
+        uint32_t n = root;
+        while (n != NIL) {
+            const Node& node = nodes[n];
+            if (node.len > maxLen || (addr & prefixMask(node.len)) != node.key) break;
+            if (node.value != NO_ROUTE) {
+                best = node.value;
+                foundLen = node.len;
+            }
+            if (node.len == 32) break;
+            n = node.child[bitAt(addr, node.len)];
+        }
+        return best;
+    }
+
+    // Czy istnieje prefiks dłuższy niż len zawarty w key/len
+    bool hasMoreSpecific(uint32_t key, int len) const {
+        key &= prefixMask(len);
+        uint32_t n = root;
+        while (n != NIL) {
+            const Node& node = nodes[n];
+            if (node.len > len)
+                return (node.key & prefixMask(len)) == key;
+            if ((key & prefixMask(node.len)) != node.key)
+                return false;
+            if (node.len == len)
+                return node.child[0] != NIL || node.child[1] != NIL;
+            n = node.child[bitAt(key, node.len)];
+        }
+        return false;
+    }
+
+    // Odwiedza w porządku prefiksowym prefiksy dłuższe niż len zawarte w key/len. Węzły dłuższe
+    // niż maxLen są zgłaszane (z wartością lub NO_ROUTE) bez schodzenia do ich poddrzew.
+    template <class F>
+    void forEachUnder(uint32_t key, int len, int maxLen, F f) const {
+        key &= prefixMask(len);
+        uint32_t n = root;
+        while (n != NIL && nodes[n].len < len) {
+            if ((key & prefixMask(nodes[n].len)) != nodes[n].key)
+                return;
+            n = nodes[n].child[bitAt(key, nodes[n].len)];
+        }
+        if (n == NIL || (nodes[n].key & prefixMask(len)) != key)
+            return;
+
+        vector<uint32_t> stack;
+        if (nodes[n].len > len) {
+            stack.push_back(n);
+        } else {
+            for (uint32_t c : nodes[n].child)
+                if (c != NIL) stack.push_back(c);
+        }
+
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.len > maxLen) {
+                f(node.key, static_cast<int>(node.len), node.value);
+                continue;
+            }
+            if (node.value != NO_ROUTE) f(node.key, static_cast<int>(node.len), node.value);
+            for (uint32_t c : node.child)
+                if (c != NIL) stack.push_back(c);
+        }
+    }
+
+    uint32_t exact(uint32_t key, int len) const {
+        key &= prefixMask(len);
+        uint32_t n = root;
+        while (n != NIL && nodes[n].len < len) {
+            if ((key & prefixMask(nodes[n].len)) != nodes[n].key)
+                return NO_ROUTE;
+            n = nodes[n].child[bitAt(key, nodes[n].len)];
+        }
+        if (n == NIL || nodes[n].len != len || nodes[n].key != key)
+            return NO_ROUTE;
+        return nodes[n].value;
+    }
+
+    template <class F>
+    void forEach(F f) const {
+        vector<uint32_t> stack;
+        if (root != NIL) stack.push_back(root);
+        while (!stack.empty()) {
+            const Node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (node.value != NO_ROUTE) f(node.key, static_cast<int>(node.len), node.value);
+            for (uint32_t c : node.child)
+                if (c != NIL) stack.push_back(c);
+        }
+    }
+
+    void assign(const PatriciaTrie& source) { *this = source; }
+
+    void clear() {
+        nodes.clear();
+        freeNodes.clear();
+        root = NIL;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+    size_t memoryUsage() const {
+        return nodes.capacity() * sizeof(Node) + freeNodes.capacity() * sizeof(uint32_t);
+    }
+};
+
+// ------------------------- LinearScan -------------------------
+// Najprostszy silnik wyszukiwania: lista prefiksów przeglądana w całości przy każdym zapytaniu.
+// Służy jako punkt odniesienia przy porównywaniu pozostałych silników.
+class LinearScan {
+    struct Entry {
+        uint32_t key;
+        int len;
+        uint32_t value;
+    };
+    vector<Entry> entries;
+
+    size_t find(uint32_t key, int len) const {
+        for (size_t i = 0; i < entries.size(); ++i)
+            if (entries[i].key == key && entries[i].len == len) return i;
+        return entries.size();
+    }
+
+public:
+    void insert(uint32_t key, int len, uint32_t value) {
+        key &= prefixMask(len);
+        size_t i = find(key, len);
+        if (i < entries.size()) entries[i].value = value;
+        else entries.push_back({key, len, value});
+    }
+
+    bool erase(uint32_t key, int len) {
+        size_t i = find(key & prefixMask(len), len);
+        if (i == entries.size())
+            return false;
+        entries[i] = entries.back();
+        entries.pop_back();
+        return true;
+    }
+
+    uint32_t lookup(uint32_t addr) const {
+        uint32_t best = NO_ROUTE;
+        int bestLen = -1;
+        for (const auto& e : entries) {
+            if (e.len > bestLen && (addr & prefixMask(e.len)) == e.key) {
+                best = e.value;
+                bestLen = e.len;
+            }
+        }
+        return best;
+    }
+
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const {
+        for (size_t i = 0; i < n; ++i) out[i] = lookup(addrs[i]);
+    }
+
+    uint32_t exact(uint32_t key, int len) const {
+        size_t i = find(key & prefixMask(len), len);
+        return i < entries.size() ? entries[i].value : NO_ROUTE;
+    }
+
+    template <class F>
+    void forEach(F f) const {
+        for (const auto& e : entries) f(e.key, e.len, e.value);
+    }
+
+    void assign(const PatriciaTrie& source) {
+        clear();
+        source.forEach([&](uint32_t key, int len, uint32_t value) { entries.push_back({key, len, value}); });
+    }
+
+    void clear() { entries.clear(); }
+    size_t size() const { return entries.size(); }
+    size_t memoryUsage() const { return entries.capacity() * sizeof(Entry); }
+};
+
+// ------------------------- Dir24_8 -------------------------
+// Dwupoziomowa tablica bezpośrednio indeksowana (DIR-24-8). Pierwszy poziom ma wpis dla każdego
+// z 2^24 początków adresu, więc prefiksy do /24 rozwiązywane są jednym odczytem pamięci.
+// Dłuższe prefiksy trafiają do 256-elementowych grup drugiego poziomu.
+// Wpis: bit 31 - odsyłacz do grupy, bity 25-30 - długość prefiksu + 1 (0 = brak trasy),
+// bity 0-24 - wartość lub numer grupy. Długość w każdym wpisie pozwala na przyrostowe
+// dodawanie i usuwanie tras, a drzewo Patricia służy do wyznaczania tras zastępczych.
+class Dir24_8 {
+    static constexpr uint32_t EXT = 0x80000000u;
+    static constexpr uint32_t VALUE_MASK = 0x01FFFFFFu;
+    static constexpr int LEN_SHIFT = 25;
+
+    vector<uint32_t> tbl24;
+    vector<uint32_t> tbl8;
+    vector<uint32_t> freeGroups;
+    PatriciaTrie control;
+
+    static uint32_t makeEntry(uint32_t value, int len) {
+        return (static_cast<uint32_t>(len + 1) << LEN_SHIFT) | value;
+    }
+
+    static int entryLen(uint32_t e) {
+        return static_cast<int>((e >> LEN_SHIFT) & 0x3F) - 1;
+    }
+
+    uint32_t allocGroup(uint32_t fill) {
+        uint32_t g;
+        if (!freeGroups.empty()) {
+            g = freeGroups.back();
+            freeGroups.pop_back();
+        } else {
+            g = static_cast<uint32_t>(tbl8.size() / 256);
+            if (g > VALUE_MASK)
+                throw runtime_error("Przekroczono liczbę grup drugiego poziomu DIR-24-8.");
+            tbl8.resize(tbl8.size() + 256);
+        }
+        fill_n(tbl8.begin() + g * 256, 256, fill);
+        return g;
+    }
+
+    // Nadpisuje wpisy z przedziału, których prefiks jest nie dłuższy niż len
+    static void fillShorter(uint32_t* entries, size_t n, uint32_t e, int len) {
+        for (size_t i = 0; i < n; ++i)
+            if (entryLen(entries[i]) <= len) entries[i] = e;
+    }
+
+    // Zastępuje wpisy ustawione przez prefiks o długości len
+    static void replaceExact(uint32_t* entries, size_t n, uint32_t e, int len) {
+        for (size_t i = 0; i < n; ++i)
+            if (entryLen(entries[i]) == len) entries[i] = e;
+    }
+
+public:
+    Dir24_8() : tbl24(1u << 24, 0) {}
+
+    void insert(uint32_t key, int len, uint32_t value) {
+        if (value >= VALUE_MASK)
+            throw runtime_error("Zbyt wiele tras dla tablicy DIR-24-8.");
+        key &= prefixMask(len);
+        control.insert(key, len, value);
+        uint32_t e = makeEntry(value, len);
+
+        if (len <= 24) {
+            uint32_t start = key >> 8;
+            uint32_t n = 1u << (24 - len);
+            for (uint32_t i = start; i < start + n; ++i) {
+                uint32_t cur = tbl24[i];
+                if (cur & EXT)
+                    fillShorter(&tbl8[(cur & VALUE_MASK) * 256], 256, e, len);
+                else if (entryLen(cur) <= len)
+                    tbl24[i] = e;
+            }
+            return;
+        }
+
+        uint32_t i = key >> 8;
+        if (!(tbl24[i] & EXT)) {
+            uint32_t g = allocGroup(tbl24[i]);
+            tbl24[i] = EXT | g;
+        }
+        uint32_t* group = &tbl8[(tbl24[i] & VALUE_MASK) * 256];
+        fillShorter(group + (key & 0xFF), 1u << (32 - len), e, len);
+    }
+
+    bool erase(uint32_t key, int len) {
+        key &= prefixMask(len);
+        if (!control.erase(key, len))
+            return false;
+
+        int coverLen;
+        uint32_t cover = control.lookupCovering(key, len - 1, coverLen);
+        uint32_t e = cover == NO_ROUTE ? 0 : makeEntry(cover, coverLen);
+
+        if (len <= 24) {
+            uint32_t start = key >> 8;
+            uint32_t n = 1u << (24 - len);
+            for (uint32_t i = start; i < start + n; ++i) {
+                uint32_t cur = tbl24[i];
+                if (cur & EXT)
+                    replaceExact(&tbl8[(cur & VALUE_MASK) * 256], 256, e, len);
+                else if (entryLen(cur) == len)
+                    tbl24[i] = e;
+            }
+            return true;
+        }
+
+        uint32_t i = key >> 8;
+        uint32_t g = tbl24[i] & VALUE_MASK;
+        uint32_t* group = &tbl8[g * 256];
+        replaceExact(group + (key & 0xFF), 1u << (32 - len), e, len);
+
+        // Grupa bez prefiksów dłuższych niż /24 ma wszystkie wpisy równe - wraca do pierwszego poziomu
+        if (all_of(group, group + 256, [](uint32_t x) { return entryLen(x) <= 24; })) {
+            tbl24[i] = group[0];
+            freeGroups.push_back(g);
+        }
+        return true;
+    }
+
+    // Odczyt gotowych tablic bez ich posiadania - używany przez silnik i przez zmapowaną z pliku
+    // migawkę FIB, dlatego operuje na surowych wskaźnikach
+    struct View {
+        const uint32_t* tbl24;      // 2^24 wpisów
+        const uint32_t* tbl8;
+        size_t tbl8Size;
+
+        uint32_t lookup(uint32_t addr) const {
+            uint32_t e = tbl24[addr >> 8];
+            if (e & EXT)
+                e = tbl8[(e & VALUE_MASK) * 256 + (addr & 0xFF)];
+            return e ? (e & VALUE_MASK) : NO_ROUTE;
+        }
+
+        // Najpierw pobiera z wyprzedzeniem wpisy pierwszego poziomu całej partii, potem grupy
+        // drugiego poziomu, tak by chybienia poszczególnych adresów nakładały się na siebie
+        void lookupBatchScalar(const uint32_t* addrs, size_t n, uint32_t* out) const {
+            uint32_t e[BATCH_LANES];
+            for (size_t base = 0; base < n; base += BATCH_LANES) {
+                size_t lanes = min(BATCH_LANES, n - base);
+                const uint32_t* a = addrs + base;
+                for (size_t i = 0; i < lanes; ++i)
+                    __builtin_prefetch(&tbl24[a[i] >> 8]);
+                for (size_t i = 0; i < lanes; ++i) {
+                    e[i] = tbl24[a[i] >> 8];
+                    if (e[i] & EXT)
+                        __builtin_prefetch(&tbl8[(e[i] & VALUE_MASK) * 256 + (a[i] & 0xFF)]);
+                }
+                for (size_t i = 0; i < lanes; ++i) {
+                    uint32_t x = e[i];
+                    if (x & EXT)
+                        x = tbl8[(x & VALUE_MASK) * 256 + (a[i] & 0xFF)];
+                    out[base + i] = x ? (x & VALUE_MASK) : NO_ROUTE;
+                }
+            }
+        }
+
+#if ROUTER_X86_SIMD
+        // 8 adresów naraz: gather z pierwszego poziomu, a dla wpisów z odsyłaczem drugi gather z maską
+        __attribute__((target("avx2")))
+        size_t lookupBatchAvx2(const uint32_t* addrs, size_t n, uint32_t* out) const {
+            const int* t24 = reinterpret_cast<const int*>(tbl24);
+            const int* t8 = reinterpret_cast<const int*>(tbl8);
+            const __m256i ext = _mm256_set1_epi32(static_cast<int>(EXT));
+            const __m256i valueMask = _mm256_set1_epi32(static_cast<int>(VALUE_MASK));
+            const __m256i lowByte = _mm256_set1_epi32(0xFF);
+            const __m256i zero = _mm256_setzero_si256();
+            const __m256i noRoute = _mm256_set1_epi32(-1);
+
+            size_t i = 0;
+            for (; i + 8 <= n; i += 8) {
+                // Gather nie ukrywa opóźnień pamięci, więc kolejne wpisy pobierane są z wyprzedzeniem
+                for (size_t j = i + BATCH_LANES; j < min(i + BATCH_LANES + 8, n); ++j)
+                    __builtin_prefetch(&tbl24[addrs[j] >> 8]);
+                __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(addrs + i));
+                __m256i e = _mm256_i32gather_epi32(t24, _mm256_srli_epi32(a, 8), 4);
+                __m256i isExt = _mm256_cmpeq_epi32(_mm256_and_si256(e, ext), ext);
+                if (!_mm256_testz_si256(isExt, isExt)) {
+                    __m256i idx = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(e, valueMask), 8),
+                                                  _mm256_and_si256(a, lowByte));
+                    e = _mm256_mask_i32gather_epi32(e, t8, idx, isExt, 4);
+                }
+                __m256i result = _mm256_blendv_epi8(_mm256_and_si256(e, valueMask), noRoute, _mm256_cmpeq_epi32(e, zero));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), result);
+            }
+            return i;
+        }
+
+        // 16 adresów naraz, ta sama logika co w wersji AVX2
+        __attribute__((target("avx512f")))
+        size_t lookupBatchAvx512(const uint32_t* addrs, size_t n, uint32_t* out) const {
+            const __m512i ext = _mm512_set1_epi32(static_cast<int>(EXT));
+            const __m512i valueMask = _mm512_set1_epi32(static_cast<int>(VALUE_MASK));
+            const __m512i lowByte = _mm512_set1_epi32(0xFF);
+            const __m512i noRoute = _mm512_set1_epi32(-1);
+            const __m512i zero = _mm512_setzero_si512();
+            const __mmask16 all = 0xFFFF;
+
+            // Wersje z maską zerującą, bo warianty bez maski korzystają z niezainicjowanych rejestrów
+            size_t i = 0;
+            for (; i + 16 <= n; i += 16) {
+                for (size_t j = i + 2 * BATCH_LANES; j < min(i + 2 * BATCH_LANES + 16, n); ++j)
+                    __builtin_prefetch(&tbl24[addrs[j] >> 8]);
+                __m512i a = _mm512_loadu_si512(addrs + i);
+                __m512i e = _mm512_mask_i32gather_epi32(zero, all, _mm512_maskz_srli_epi32(all, a, 8), tbl24, 4);
+                __mmask16 isExt = _mm512_test_epi32_mask(e, ext);
+                if (isExt) {
+                    __m512i idx = _mm512_or_si512(_mm512_maskz_slli_epi32(all, _mm512_and_si512(e, valueMask), 8),
+                                                  _mm512_and_si512(a, lowByte));
+                    e = _mm512_mask_i32gather_epi32(e, isExt, idx, tbl8, 4);
+                }
+                __mmask16 empty = _mm512_cmpeq_epi32_mask(e, zero);
+                __m512i result = _mm512_mask_blend_epi32(empty, _mm512_and_si512(e, valueMask), noRoute);
+                _mm512_storeu_si512(out + i, result);
+            }
+            return i;
+        }
+#endif
+
+        void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const {
+            size_t done = 0;
+#if ROUTER_X86_SIMD
+            // Indeksy gather są 32-bitowe ze znakiem, więc drugi poziom musi mieścić się w 2^31 wpisach
+            if (tbl8Size < (1u << 31)) {
+                switch (activeSimdLevel().load(memory_order_relaxed)) {
+                    case SimdLevel::Avx512: done = lookupBatchAvx512(addrs, n, out); break;
+                    case SimdLevel::Avx2: done = lookupBatchAvx2(addrs, n, out); break;
+                    default: break;
+                }
+            }
+#endif
+            lookupBatchScalar(addrs + done, n - done, out + done);
+        }
+    };
+
+    View view() const { return {tbl24.data(), tbl8.data(), tbl8.size()}; }
+
+    uint32_t lookup(uint32_t addr) const { return view().lookup(addr); }
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const { view().lookupBatch(addrs, n, out); }
+
+    uint32_t exact(uint32_t key, int len) const { return control.exact(key, len); }
+
+    template <class F>
+    void forEach(F f) const { control.forEach(f); }
+
+    void assign(const PatriciaTrie& source) {
+        clear();
+        source.forEach([&](uint32_t key, int len, uint32_t value) { insert(key, len, value); });
+    }
+
+    void clear() {
+        fill(tbl24.begin(), tbl24.end(), 0);
+        tbl8.clear();
+        freeGroups.clear();
+        control.clear();
+    }
+
+    size_t size() const { return control.size(); }
+    size_t memoryUsage() const {
+        return tbl24.capacity() * sizeof(uint32_t) + tbl8.capacity() * sizeof(uint32_t)
+             + freeGroups.capacity() * sizeof(uint32_t) + control.memoryUsage();
+    }
+};
+
+// ------------------------- Poptrie -------------------------
+// Skompresowane drzewo wielobitowe w stylu Poptrie. Pierwsze 16 bitów adresu indeksuje tablicę
+// bezpośrednią, dalej każdy węzeł obsługuje 6 bitów. Węzeł ma dwie 64-bitowe mapy: 'children'
+// (które pozycje są węzłami) i 'leafStarts' (gdzie zaczyna się nowy ciąg jednakowych liści),
+// a pozycję dziecka wyznacza popcount, dzięki czemu potomkowie leżą w zwartych blokach.
+// Każda zmiana przebudowuje tylko poddrzewa tych wpisów /16, które obejmuje prefiks.
+class Poptrie {
+    static constexpr int DIRECT_BITS = 16;
+    static constexpr int STRIDE = 6;
+    static constexpr uint32_t DIRECT_LEAF = 0x80000000u;
+
+    struct Node {
+        uint64_t children;
+        uint64_t leafStarts;
+        uint32_t leafBase;
+        uint32_t childBase;
+    };
+
+    // Pula bloków o stałych rozmiarach (1-64 elementów) z listami wolnych bloków
+    template <class T>
+    struct BlockPool {
+        vector<T> data;
+        vector<uint32_t> freeBlocks[65];
+
+        uint32_t alloc(int n) {
+            if (n == 0) return 0;
+            if (!freeBlocks[n].empty()) {
+                uint32_t base = freeBlocks[n].back();
+                freeBlocks[n].pop_back();
+                return base;
+            }
+            data.resize(data.size() + n);
+            return static_cast<uint32_t>(data.size() - n);
+        }
+
+        void release(uint32_t base, int n) {
+            if (n > 0) freeBlocks[n].push_back(base);
+        }
+
+        void clear() {
+            data.clear();
+            for (auto& f : freeBlocks) f.clear();
+        }
+
+        size_t memoryUsage() const {
+            size_t bytes = data.capacity() * sizeof(T);
+            for (const auto& f : freeBlocks) bytes += f.capacity() * sizeof(uint32_t);
+            return bytes;
+        }
+    };
+
+    vector<uint32_t> direct;
+    BlockPool<Node> nodes;
+    BlockPool<uint32_t> leaves;
+    PatriciaTrie control;
+
+    static int chunk(uint32_t addr, int offset) {
+        if (offset + STRIDE <= 32)
+            return (addr >> (32 - STRIDE - offset)) & 0x3F;
+        return (addr << (offset + STRIDE - 32)) & 0x3F;
+    }
+
+    static uint32_t encodeLeaf(uint32_t value) {
+        return DIRECT_LEAF | (value & ~DIRECT_LEAF);
+    }
+
+    static uint32_t decodeLeaf(uint32_t e) {
+        e &= ~DIRECT_LEAF;
+        return e == ~DIRECT_LEAF ? NO_ROUTE : e;
+    }
+
+    // Buduje węzeł dla bitów [offset, offset+6) pod prefiksem base; inherited to trasa pokrywająca cały węzeł
+    Node build(uint32_t base, int offset, uint32_t inherited) {
+        Node node{0, 0, 0, 0};
+        int childLen = min(offset + STRIDE, 32);
+        uint32_t values[64];
+        uint32_t childKeys[64];
+        fill_n(values, 64, inherited);
+
+        // Przejście w porządku prefiksowym maluje krótsze prefiksy przed zawartymi w nich dłuższymi
+        control.forEachUnder(base, offset, childLen, [&](uint32_t key, int len, uint32_t value) {
+            int first = chunk(key, offset);
+            if (len > childLen) {
+                node.children |= 1ull << first;
+                return;
+            }
+            fill_n(values + first, 64 >> (len - offset), value);
+        });
+
+        uint32_t leafValues[64];
+        int leafCount = 0, childCount = 0;
+        for (int i = 0; i < 64; ++i) {
+            if (node.children & (1ull << i)) {
+                childKeys[childCount++] = base | (static_cast<uint32_t>(i) << (32 - STRIDE - offset));
+                continue;
+            }
+            if (leafCount == 0 || leafValues[leafCount - 1] != values[i]) {
+                node.leafStarts |= 1ull << i;
+                leafValues[leafCount++] = values[i];
+            }
+        }
+
+        node.leafBase = leaves.alloc(leafCount);
+        copy(leafValues, leafValues + leafCount, leaves.data.begin() + node.leafBase);
+        node.childBase = nodes.alloc(childCount);
+        for (int i = 0, c = 0; i < 64; ++i) {
+            if (!(node.children & (1ull << i))) continue;
+            Node child = build(childKeys[c], offset + STRIDE, values[i]);
+            nodes.data[node.childBase + c++] = child;
+        }
+        return node;
+    }
+
+    void releaseSubtree(const Node& node) {
+        int childCount = __builtin_popcountll(node.children);
+        for (int i = 0; i < childCount; ++i)
+            releaseSubtree(nodes.data[node.childBase + i]);
+        nodes.release(node.childBase, childCount);
+        leaves.release(node.leafBase, __builtin_popcountll(node.leafStarts));
+    }
+
+    void rebuildDirect(uint32_t d) {
+        if (!(direct[d] & DIRECT_LEAF)) {
+            releaseSubtree(nodes.data[direct[d]]);
+            nodes.release(direct[d], 1);
+        }
+
+        uint32_t key = d << DIRECT_BITS;
+        int foundLen;
+        uint32_t inherited = control.lookupCovering(key, DIRECT_BITS, foundLen);
+        if (control.hasMoreSpecific(key, DIRECT_BITS)) {
+            Node root = build(key, DIRECT_BITS, inherited);
+            uint32_t n = nodes.alloc(1);
+            nodes.data[n] = root;
+            direct[d] = n;
+        } else {
+            direct[d] = encodeLeaf(inherited);
+        }
+    }
+
+    void update(uint32_t key, int len) {
+        uint32_t first = key >> DIRECT_BITS;
+        uint32_t n = len <= DIRECT_BITS ? 1u << (DIRECT_BITS - len) : 1;
+        for (uint32_t d = first; d < first + n; ++d)
+            rebuildDirect(d);
+    }
+
+public:
+    Poptrie() : direct(1u << DIRECT_BITS, encodeLeaf(NO_ROUTE)) {}
+
+    void insert(uint32_t key, int len, uint32_t value) {
+        if (value >= ~DIRECT_LEAF)
+            throw runtime_error("Zbyt wiele tras dla drzewa Poptrie.");
+        key &= prefixMask(len);
+        control.insert(key, len, value);
+        update(key, len);
+    }
+
+    bool erase(uint32_t key, int len) {
+        key &= prefixMask(len);
+        if (!control.erase(key, len))
+            return false;
+        update(key, len);
+        return true;
+    }
+
+    // Budowa od zera z gotowego zbioru prefiksów - jedno przejście zamiast przebudowy przy każdej trasie
+    void assign(const PatriciaTrie& source) {
+        clear();
+        control = source;
+        for (uint32_t d = 0; d < direct.size(); ++d)
+            rebuildDirect(d);
+    }
+
+    uint32_t lookup(uint32_t addr) const {
+        uint32_t d = direct[addr >> DIRECT_BITS];
+        if (d & DIRECT_LEAF)
+            return decodeLeaf(d);
+
+        const Node* node = &nodes.data[d];
+        int offset = DIRECT_BITS;
+        while (true) {
+            uint64_t bit = 1ull << chunk(addr, offset);
+            uint64_t upTo = bit | (bit - 1);
+            if (!(node->children & bit))
+                return leaves.data[node->leafBase + __builtin_popcountll(node->leafStarts & upTo) - 1];
+            node = &nodes.data[node->childBase + __builtin_popcountll(node->children & upTo) - 1];
+            offset += STRIDE;
+        }
+    }
+
+    // Wyszukiwania z partii schodzą po węzłach równolegle z pobieraniem z wyprzedzeniem
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const {
+        const Node* cur[BATCH_LANES];
+        for (size_t base = 0; base < n; base += BATCH_LANES) {
+            size_t lanes = min(BATCH_LANES, n - base);
+            const uint32_t* a = addrs + base;
+            for (size_t i = 0; i < lanes; ++i)
+                __builtin_prefetch(&direct[a[i] >> DIRECT_BITS]);
+
+            bool active = false;
+            for (size_t i = 0; i < lanes; ++i) {
+                uint32_t d = direct[a[i] >> DIRECT_BITS];
+                if (d & DIRECT_LEAF) {
+                    out[base + i] = decodeLeaf(d);
+                    cur[i] = nullptr;
+                } else {
+                    cur[i] = &nodes.data[d];
+                    __builtin_prefetch(cur[i]);
+                    active = true;
+                }
+            }
+
+            for (int offset = DIRECT_BITS; active; offset += STRIDE) {
+                active = false;
+                for (size_t i = 0; i < lanes; ++i) {
+                    const Node* node = cur[i];
+                    if (!node) continue;
+                    uint64_t bit = 1ull << chunk(a[i], offset);
+                    uint64_t upTo = bit | (bit - 1);
+                    if (!(node->children & bit)) {
+                        out[base + i] = leaves.data[node->leafBase + __builtin_popcountll(node->leafStarts & upTo) - 1];
+                        cur[i] = nullptr;
+                        continue;
+                    }
+                    cur[i] = &nodes.data[node->childBase + __builtin_popcountll(node->children & upTo) - 1];
+                    __builtin_prefetch(cur[i]);
+                    active = true;
+                }
+            }
+        }
+    }
+
+    uint32_t exact(uint32_t key, int len) const { return control.exact(key, len); }
+
+    template <class F>
+    void forEach(F f) const { control.forEach(f); }
+
+    void clear() {
+        fill(direct.begin(), direct.end(), encodeLeaf(NO_ROUTE));
+        nodes.clear();
+        leaves.clear();
+        control.clear();
+    }
+
+    size_t size() const { return control.size(); }
+    size_t memoryUsage() const {
+        return direct.capacity() * sizeof(uint32_t) + nodes.memoryUsage() + leaves.memoryUsage()
+             + control.memoryUsage();
+    }
+};
+
+// ------------------------- PrefixLengthSearch -------------------------
+// Wyszukiwanie binarne po długościach prefiksów (Waldvogel i in.): osobna tablica haszująca
+// dla każdej długości 0-32 i stałe drzewo wyszukiwania po długościach (najwyżej 6 sond).
+// Prefiks zostawia znaczniki na krótszych długościach leżących na jego ścieżce, żeby
+// wyszukiwanie wiedziało, że warto szukać dłużej; każdy wpis pamięta też najlepszą trasę
+// o długości nie większej od własnej (bmp), więc nieudane zejście w prawo nie wymaga powrotu.
+// Zmiana trasy dotyka samego prefiksu i O(log W) znaczników na jego ścieżce, ale także bmp
+// wszystkich wpisów zawartych w zmienianym prefiksie: koszt to O(log W + k log n), gdzie k to
+// liczba wpisów (prefiksów i znaczników) pod nim - dla krótkiego prefiksu (np. /8) może to być
+// znaczna część tablicy. Ograniczenie do O(log W) wymagałoby rezygnacji z bmp we wpisach.
+class PrefixLengthSearch {
+    struct Entry {
+        uint32_t value = NO_ROUTE;  // trasa dla dokładnie tego prefiksu
+        uint32_t bmp = NO_ROUTE;    // najlepsza trasa o długości nie większej niż ten wpis
+        int bmpLen = -1;
+        uint32_t markers = 0;       // liczba dłuższych prefiksów korzystających z tego znacznika
+    };
+
+    unordered_map<uint32_t, Entry> tables[33];
+    set<uint64_t> ordered;          // (długość << 32 | bity) - do wyliczania wpisów pod prefiksem
+    size_t count = 0;
+
+    static uint64_t orderKey(int len, uint32_t key) {
+        return (static_cast<uint64_t>(len) << 32) | key;
+    }
+
+    // Najdłuższa prawdziwa trasa pokrywająca key o długości nie większej niż maxLen
+    uint32_t bestReal(uint32_t key, int maxLen, int& foundLen) const {
+        for (int len = maxLen; len >= 0; --len) {
+            if (tables[len].empty()) continue;
+            auto it = tables[len].find(key & prefixMask(len));
+            if (it != tables[len].end() && it->second.value != NO_ROUTE) {
+                foundLen = len;
+                return it->second.value;
+            }
+        }
+        foundLen = -1;
+        return NO_ROUTE;
+    }
+
+    Entry& entryAt(int len, uint32_t key) {
+        auto it = tables[len].find(key);
+        if (it != tables[len].end())
+            return it->second;
+        Entry& e = tables[len][key];
+        e.bmp = bestReal(key, len, e.bmpLen);
+        ordered.insert(orderKey(len, key));
+        return e;
+    }
+
+    void dropIfUnused(int len, uint32_t key) {
+        auto it = tables[len].find(key);
+        if (it != tables[len].end() && it->second.value == NO_ROUTE && it->second.markers == 0) {
+            tables[len].erase(it);
+            ordered.erase(orderKey(len, key));
+        }
+    }
+
+    // Długości sprawdzane przed dotarciem do len - na nich leżą znaczniki prefiksu
+    template <class F>
+    static void forEachMarkerLength(int len, F f) {
+        int lo = 0, hi = 32;
+        while (true) {
+            int mid = (lo + hi) / 2;
+            if (mid == len) return;
+            if (len > mid) {
+                f(mid);
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+    }
+
+    // Ustawia bmp wpisów zawartych w key/len, które dotąd wskazywały trasę nie dłuższą niż fromLen.
+    // Przegląda każdy wpis pod prefiksem na każdej długości od len do 32 - O(k log n) dla k wpisów.
+    void updateBmp(uint32_t key, int len, int fromLen, uint32_t bmp, int bmpLen, bool exactOnly) {
+        uint32_t last = key | ~prefixMask(len);
+        for (int m = len; m <= 32; ++m) {
+            if (tables[m].empty()) continue;
+            auto it = ordered.lower_bound(orderKey(m, key));
+            auto end = ordered.upper_bound(orderKey(m, last));
+            for (; it != end; ++it) {
+                Entry& e = tables[m].find(static_cast<uint32_t>(*it))->second;
+                if (exactOnly ? e.bmpLen == fromLen : e.bmpLen <= fromLen) {
+                    e.bmp = bmp;
+                    e.bmpLen = bmpLen;
+                }
+            }
+        }
+    }
+
+public:
+    void insert(uint32_t key, int len, uint32_t value) {
+        key &= prefixMask(len);
+        forEachMarkerLength(len, [&](int m) { ++entryAt(m, key & prefixMask(m)).markers; });
+
+        Entry& e = entryAt(len, key);
+        bool added = e.value == NO_ROUTE;
+        e.value = value;
+        if (added) ++count;
+        updateBmp(key, len, len, value, len, false);
+
+        // Znaczniki dodane przy ponownym wstawieniu są zbędne - istniały już wcześniej
+        if (!added)
+            forEachMarkerLength(len, [&](int m) { --tables[m].find(key & prefixMask(m))->second.markers; });
+    }
+
+    bool erase(uint32_t key, int len) {
+        key &= prefixMask(len);
+        auto it = tables[len].find(key);
+        if (it == tables[len].end() || it->second.value == NO_ROUTE)
+            return false;
+
+        it->second.value = NO_ROUTE;
+        --count;
+        int coverLen = -1;
+        uint32_t cover = len > 0 ? bestReal(key, len - 1, coverLen) : NO_ROUTE;
+        updateBmp(key, len, len, cover, coverLen, true);
+
+        dropIfUnused(len, key);
+        forEachMarkerLength(len, [&](int m) {
+            uint32_t mkey = key & prefixMask(m);
+            --tables[m].find(mkey)->second.markers;
+            dropIfUnused(m, mkey);
+        });
+        return true;
+    }
+
+    uint32_t lookup(uint32_t addr) const {
+        uint32_t best = NO_ROUTE;
+        int lo = 0, hi = 32;
+        while (lo <= hi) {
+            int mid = (lo + hi) / 2;
+            const auto& table = tables[mid];
+            auto it = table.empty() ? table.end() : table.find(addr & prefixMask(mid));
+            if (it != table.end()) {
+                best = it->second.bmp;
+                lo = mid + 1;
+            } else {
+                hi = mid - 1;
+            }
+        }
+        return best;
+    }
+
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const {
+        for (size_t i = 0; i < n; ++i) out[i] = lookup(addrs[i]);
+    }
+
+    uint32_t exact(uint32_t key, int len) const {
+        auto it = tables[len].find(key & prefixMask(len));
+        return it == tables[len].end() ? NO_ROUTE : it->second.value;
+    }
+
+    template <class F>
+    void forEach(F f) const {
+        for (int len = 0; len <= 32; ++len)
+            for (const auto& [key, e] : tables[len])
+                if (e.value != NO_ROUTE) f(key, len, e.value);
+    }
+
+    void assign(const PatriciaTrie& source) {
+        clear();
+        source.forEach([&](uint32_t key, int len, uint32_t value) { insert(key, len, value); });
+    }
+
+    void clear() {
+        for (auto& t : tables) t.clear();
+        ordered.clear();
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    // Szacunek: węzły list haszujących i drzewa uporządkowanego z narzutem na wskaźniki
+    size_t memoryUsage() const {
+        size_t bytes = ordered.size() * (sizeof(uint64_t) + 4 * sizeof(void*));
+        for (const auto& t : tables)
+            bytes += t.bucket_count() * sizeof(void*) + t.size() * (sizeof(pair<uint32_t, Entry>) + sizeof(void*));
+        return bytes;
+    }
+};
+
+// ------------------------- LpmEngine -------------------------
+// Wspólny interfejs silników wyszukiwania najdłuższego prefiksu. Silniki są zwykłymi klasami
+// o jednakowym zestawie metod (insert/erase/lookup/exact/forEach/assign), a szablon
+// LpmEngineAdapter opakowuje je tak, by RoutingTable mogła wymieniać je w czasie działania.
+#ifndef ROUTER_DEFAULT_ENGINE
+#define ROUTER_DEFAULT_ENGINE "trie"
+#endif
+
+class LpmEngine {
+public:
+    using Visitor = function<void(uint32_t key, int len, uint32_t value)>;
+
+    virtual ~LpmEngine() = default;
+    virtual const char* name() const = 0;
+    virtual void insert(uint32_t key, int len, uint32_t value) = 0;
+    virtual bool erase(uint32_t key, int len) = 0;
+    virtual uint32_t lookup(uint32_t addr) const = 0;
+    virtual void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const = 0;
+    virtual uint32_t exact(uint32_t key, int len) const = 0;
+    virtual void forEach(const Visitor& f) const = 0;
+    virtual size_t size() const = 0;
+    virtual size_t memoryUsage() const = 0;
+    virtual unique_ptr<LpmEngine> clone() const = 0;
+
+    // Przebudowa z zawartości innego silnika jednym przejściem
+    void assign(const LpmEngine& source) {
+        PatriciaTrie prefixes;
+        source.forEach([&](uint32_t key, int len, uint32_t value) { prefixes.insert(key, len, value); });
+        assign(prefixes);
+    }
+
+    virtual void assign(const PatriciaTrie& prefixes) = 0;
+};
+
+template <class Impl>
+class LpmEngineAdapter final : public LpmEngine {
+    const char* engineName;
+    Impl impl;
+public:
+    explicit LpmEngineAdapter(const char* name) : engineName(name) {}
+
+    using LpmEngine::assign;
+
+    const char* name() const override { return engineName; }
+    void insert(uint32_t key, int len, uint32_t value) override { impl.insert(key, len, value); }
+    bool erase(uint32_t key, int len) override { return impl.erase(key, len); }
+    uint32_t lookup(uint32_t addr) const override { return impl.lookup(addr); }
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const override {
+        impl.lookupBatch(addrs, n, out);
+    }
+    uint32_t exact(uint32_t key, int len) const override { return impl.exact(key, len); }
+    void forEach(const Visitor& f) const override { impl.forEach(f); }
+    void assign(const PatriciaTrie& prefixes) override { impl.assign(prefixes); }
+    size_t size() const override { return impl.size(); }
+    size_t memoryUsage() const override { return impl.memoryUsage(); }
+    unique_ptr<LpmEngine> clone() const override { return make_unique<LpmEngineAdapter>(*this); }
+};
+
+// Nazwy silników dostępnych w poleceniu 'engine'
+inline const vector<string>& lpmEngineNames() {
+    static const vector<string> names = {"linear", "trie", "dir24", "poptrie", "lengths"};
+    return names;
+}
+
+inline unique_ptr<LpmEngine> makeLpmEngine(const string& name) {
+    if (name == "linear") return make_unique<LpmEngineAdapter<LinearScan>>("linear");
+    if (name == "trie") return make_unique<LpmEngineAdapter<PatriciaTrie>>("trie");
+    if (name == "dir24") return make_unique<LpmEngineAdapter<Dir24_8>>("dir24");
+    if (name == "poptrie") return make_unique<LpmEngineAdapter<Poptrie>>("poptrie");
+    if (name == "lengths") return make_unique<LpmEngineAdapter<PrefixLengthSearch>>("lengths");
+    throw invalid_argument("Nieznany silnik wyszukiwania: " + name + ".");
+}
+
+// ------------------------- LookupCache -------------------------
+// Zbiorowo-asocjacyjna pamięć podręczna ostatnich wyników wyszukiwania (adres docelowy -> wartość).
+// Wpisy są oznaczone numerem generacji tablicy routingu; każda zmiana tablicy zwiększa
+// generację, więc stare wpisy przestają pasować bez przeglądania pamięci podręcznej.
+// Nie jest bezpieczna wątkowo - każdy wątek przekazujący powinien mieć własną instancję.
+// Tylko liczniki trafień można odczytywać z innego wątku (do sumowania statystyk).
+class LookupCache {
+    static constexpr int WAYS = 4;
+
+    struct alignas(64) Set {
+        uint32_t dst[WAYS];
+        uint32_t value[WAYS];
+        uint64_t generation[WAYS];  // 0 = pusty wpis
+    };
+
+    vector<Set> sets;
+    uint32_t setMask = 0;
+    atomic<uint64_t> hits{0};       // zapisuje tylko wątek właściciel - bez instrukcji atomowych RMW
+    atomic<uint64_t> misses{0};
+
+    static void bump(atomic<uint64_t>& counter) {
+        counter.store(counter.load(memory_order_relaxed) + 1, memory_order_relaxed);
+    }
+
+    static uint32_t hashOf(uint32_t dst) { return dst * 0x9E3779B1u; }
+
+    Set& setFor(uint32_t dst) {
+        return sets[(hashOf(dst) >> 16) & setMask];
+    }
+
+public:
+    explicit LookupCache(size_t entries = 4096) { resize(entries); }
+
+    // Rozmiar zaokrąglany w górę do potęgi dwójki; 0 wyłącza pamięć podręczną
+    void resize(size_t entries) {
+        size_t setCount = 0;
+        if (entries > 0) {
+            setCount = 1;
+            while (setCount * WAYS < entries) setCount <<= 1;
+        }
+        sets.assign(setCount, Set{});
+        setMask = setCount ? static_cast<uint32_t>(setCount - 1) : 0;
+        resetStats();
+    }
+
+    bool get(uint32_t dst, uint64_t generation, uint32_t& value) {
+        if (sets.empty()) return false;
+        const Set& s = setFor(dst);
+        for (int w = 0; w < WAYS; ++w) {
+            if (s.generation[w] == generation && s.dst[w] == dst) {
+                value = s.value[w];
+                bump(hits);
+                return true;
+            }
+        }
+        bump(misses);
+        return false;
+    }
+
+    // Najpierw zajmuje wpis nieaktualny, a gdy wszystkie są aktualne - wybrany pseudolosowo
+    void put(uint32_t dst, uint64_t generation, uint32_t value) {
+        if (sets.empty()) return;
+        Set& s = setFor(dst);
+        int w = (hashOf(dst) >> 8) % WAYS;
+        for (int i = 0; i < WAYS; ++i) {
+            if (s.generation[i] != generation) {
+                w = i;
+                break;
+            }
+        }
+        s.dst[w] = dst;
+        s.value[w] = value;
+        s.generation[w] = generation;
+    }
+
+    void clear() {
+        fill(sets.begin(), sets.end(), Set{});
+    }
+
+    void resetStats() {
+        hits.store(0, memory_order_relaxed);
+        misses.store(0, memory_order_relaxed);
+    }
+
+    size_t capacity() const { return sets.size() * WAYS; }
+    uint64_t hitCount() const { return hits.load(memory_order_relaxed); }
+    uint64_t missCount() const { return misses.load(memory_order_relaxed); }
+    size_t memoryUsage() const { return sets.capacity() * sizeof(Set); }
+};
+
+// ------------------------- LeftRight -------------------------
+// Liczniki czytelników rozłożone na osobne linie pamięci podręcznej, by wątki nie walczyły o jedną
+class ReadIndicator {
+    static constexpr size_t SLOTS = 64;
+    struct alignas(64) Counter {
+        atomic<int64_t> value{0};
+    };
+    Counter counters[SLOTS];
+
+    static size_t threadSlot() {
+        static atomic<size_t> next{0};
+        thread_local size_t slot = next++ % SLOTS;
+        return slot;
+    }
+
+public:
+    void arrive() { counters[threadSlot()].value.fetch_add(1); }
+    void depart() { counters[threadSlot()].value.fetch_sub(1, memory_order_release); }
+
+    bool empty() const {
+        for (const auto& c : counters)
+            if (c.value.load(memory_order_acquire) != 0) return false;
+        return true;
+    }
+};
+
+// Dwie kopie struktury danych w schemacie Left-Right: czytelnicy zawsze korzystają z kopii
+// opublikowanej jako bieżąca i nigdy nie czekają ani nie widzą zmiany w połowie. Pisarz
+// zmienia kopię ukrytą, publikuje ją, czeka aż czytelnicy opuszczą starą (rola epok
+// w RCU pełnią tu dwa liczniki wersji) i powtarza tę samą zmianę na drugiej kopii.
+// Zmiany muszą więc być deterministyczne.
+template <class T>
+class LeftRight {
+    T instances[2];
+    atomic<int> readIndex{0};
+    atomic<int> versionIndex{0};
+    mutable ReadIndicator indicators[2];
+    mutex writer;
+
+    atomic<uint64_t> updates{0};
+    atomic<uint64_t> totalUpdateNs{0};
+    atomic<uint64_t> maxUpdateNs{0};
+
+    void waitForReaders(int version) const {
+        while (!indicators[version].empty())
+            this_thread::yield();
+    }
+
+public:
+    template <class F>
+    auto read(F f) const -> decltype(f(instances[0])) {
+        struct Guard {
+            ReadIndicator& indicator;
+            ~Guard() { indicator.depart(); }
+        };
+        ReadIndicator& indicator = indicators[versionIndex.load()];
+        indicator.arrive();
+        Guard guard{indicator};
+        return f(instances[readIndex.load()]);
+    }
+
+    // Zwraca wynik pierwszego wykonania f; drugie, na starej kopii, musi dać ten sam efekt.
+    // Wyjątek z f jest dopuszczalny tylko zanim f cokolwiek zmieni.
+    template <class F>
+    auto modify(F f) -> decltype(f(instances[0])) {
+        lock_guard<mutex> lock(writer);
+        auto start = chrono::steady_clock::now();
+        int current = readIndex.load(memory_order_relaxed);
+
+        auto finish = [&] {
+            readIndex.store(1 - current);
+            int prev = versionIndex.load(memory_order_relaxed);
+            waitForReaders(1 - prev);
+            versionIndex.store(1 - prev);
+            waitForReaders(prev);
+            f(instances[current]);
+
+            uint64_t ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            updates.fetch_add(1, memory_order_relaxed);
+            totalUpdateNs.fetch_add(ns, memory_order_relaxed);
+            if (ns > maxUpdateNs.load(memory_order_relaxed)) maxUpdateNs.store(ns, memory_order_relaxed);
+        };
+
+        if constexpr (is_void_v<decltype(f(instances[0]))>) {
+            f(instances[1 - current]);
+            finish();
+        } else {
+            auto result = f(instances[1 - current]);
+            finish();
+            return result;
+        }
+    }
+
+    uint64_t updateCount() const { return updates.load(memory_order_relaxed); }
+    uint64_t maxUpdateNanos() const { return maxUpdateNs.load(memory_order_relaxed); }
+    double avgUpdateNanos() const {
+        uint64_t n = updateCount();
+        return n ? static_cast<double>(totalUpdateNs.load(memory_order_relaxed)) / n : 0.0;
+    }
+};
+
+// ------------------------- FibSnapshot -------------------------
+// Wybór trasy z grupy ECMP dla przepływu, wspólny dla tablicy i migawki FIB. Gdy brama wybranej
+// trasy nie działa, przepływ próbuje kilku innych kubełków swojej grupy (rozkładając ruch między
+// działające bramy), potem pozostałych członków po kolei, a na końcu tras zapasowych według
+// metryki - fallback() zwraca pierwszą działającą albo NO_ROUTE i jest wołany tylko wtedy.
+// Koszt nie zależy od liczby tras przez bramę, bo żadna grupa nie jest przebudowywana.
+template <class Group, class Usable, class Fallback>
+uint32_t selectFromGroup(const Group& g, uint32_t flowHash, Usable usable, Fallback fallback) {
+    static constexpr uint32_t PROBES = 4;
+    uint32_t slot = g.select(flowHash);
+    if (usable(slot))
+        return slot;
+    if (g.size() > 1) {
+        for (uint32_t i = 0; i < PROBES; ++i) {
+            flowHash = flowHash * 0x9E3779B1u + 0x7F4A7C15u;
+            slot = g.select(flowHash);
+            if (usable(slot))
+                return slot;
+        }
+        for (uint32_t member : g.slots())
+            if (usable(member))
+                return member;
+    }
+    return fallback();
+}
+
+// Nagłówek pliku migawki. Sekcje są opisane przesunięciem od początku pliku, a nie wskaźnikami,
+// więc plik można zmapować pod dowolnym adresem. Liczby zapisane są w porządku bajtów maszyny,
+// który sprawdza pole byteOrder.
+struct SnapshotHeader {
+    static constexpr char MAGIC[8] = {'R', 'S', 'F', 'I', 'B', 0, 0, 0};
+    static constexpr uint32_t VERSION = 2;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+    static constexpr size_t ALIGNMENT = 64;
+
+    enum Section {
+        Tbl24, Tbl8,                                     // skompilowane tablice DIR-24-8
+        PrefixKey, PrefixLen, PrefixGroup,               // prefiksy posortowane według (adres, długość)
+        Network, Prefix, Metric, Gateway, Via, Usable, GroupOf,   // kolumny slotów tras
+        MemberStart, Members, BucketStart, Buckets, Shift,        // grupy ECMP
+        BackupStart, Backups,                            // trasy zapasowe grup według metryki
+        Down,                                            // adresy bram zgłoszonych jako niedziałające
+        SectionCount
+    };
+
+    struct Extent {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint64_t fileSize;
+    uint32_t slots;
+    uint32_t routes;
+    uint32_t groups;
+    uint32_t prefixes;
+    char engine[16];        // silnik, do którego migawka jest wczytywana przy pierwszej zmianie
+    Extent sections[SectionCount];
+};
+
+// Migawka FIB zmapowana tylko do odczytu. Wyszukiwanie i wybór trasy działają wprost na
+// zmapowanych sekcjach, więc otwarcie kosztuje tyle co sprawdzenie nagłówka, a strony pliku
+// są wczytywane przy pierwszym użyciu i współdzielone przez procesy korzystające z tego pliku.
+// Zawartość sekcji nie jest sprawdzana - plik ma pochodzić z polecenia save.
+class FibSnapshot {
+    MappedFile file;
+    const SnapshotHeader* header;
+    Dir24_8::View fib;
+    const uint32_t* prefixKeys;
+    const uint8_t* prefixLens;
+    const uint32_t* prefixGroups;
+    const uint32_t* networks;
+    const uint8_t* prefixes;        // PREFIX_FREE dla wolnego slotu
+    const int32_t* metrics;
+    const uint32_t* gateways;
+    const uint32_t* vias;
+    const uint8_t* usableFlags;
+    const uint32_t* groupOfSlot;
+    const uint32_t* memberStart;
+    const uint32_t* members;
+    const uint32_t* bucketStart;
+    const uint16_t* buckets;
+    const uint8_t* shifts;
+    const uint32_t* backupStart;
+    const uint32_t* backups;
+    const uint32_t* downAddrs;
+    size_t downCount;
+
+    template <class T>
+    const T* section(SnapshotHeader::Section id, size_t count) const {
+        const SnapshotHeader::Extent& e = header->sections[id];
+        if (e.offset % SnapshotHeader::ALIGNMENT != 0 || e.bytes != count * sizeof(T)
+            || e.offset > file.size() || e.bytes > file.size() - e.offset)
+            throw runtime_error("Uszkodzona migawka FIB: nieprawidłowa sekcja " + to_string(id) + ".");
+        return reinterpret_cast<const T*>(file.data() + e.offset);
+    }
+
+public:
+    static constexpr uint8_t PREFIX_FREE = 0xFF;
+
+    // Widok grupy ECMP o interfejsie NextHopGroup
+    struct Group {
+        const uint32_t* first;
+        uint32_t count;
+        const uint16_t* buckets;
+        uint32_t bucketCount;
+        int shift;
+
+        struct Range {
+            const uint32_t* first;
+            const uint32_t* last;
+            const uint32_t* begin() const { return first; }
+            const uint32_t* end() const { return last; }
+        };
+
+        uint32_t select(uint32_t flowHash) const {
+            return bucketCount == 0 ? first[0] : first[buckets[flowHash >> shift]];
+        }
+        size_t size() const { return count; }
+        Range slots() const { return {first, first + count}; }
+    };
+
+    explicit FibSnapshot(const string& path) : file(path, false) {
+        if (file.size() < sizeof(SnapshotHeader))
+            throw runtime_error("Plik " + path + " nie jest migawką FIB.");
+        header = reinterpret_cast<const SnapshotHeader*>(file.data());
+        if (memcmp(header->magic, SnapshotHeader::MAGIC, sizeof(header->magic)) != 0)
+            throw runtime_error("Plik " + path + " nie jest migawką FIB.");
+        if (header->version != SnapshotHeader::VERSION || header->byteOrder != SnapshotHeader::ENDIAN_MARK)
+            throw runtime_error("Migawka " + path + " pochodzi z innej wersji programu lub innej architektury.");
+        if (header->fileSize != file.size())
+            throw runtime_error("Migawka " + path + " jest niekompletna.");
+
+        using S = SnapshotHeader;
+        size_t slots = header->slots, groups = header->groups, count = header->prefixes;
+        const SnapshotHeader::Extent& tbl8 = header->sections[S::Tbl8];
+        fib = {section<uint32_t>(S::Tbl24, size_t(1) << 24), section<uint32_t>(S::Tbl8, tbl8.bytes / 4), tbl8.bytes / 4};
+        prefixKeys = section<uint32_t>(S::PrefixKey, count);
+        prefixLens = section<uint8_t>(S::PrefixLen, count);
+        prefixGroups = section<uint32_t>(S::PrefixGroup, count);
+        networks = section<uint32_t>(S::Network, slots);
+        prefixes = section<uint8_t>(S::Prefix, slots);
+        metrics = section<int32_t>(S::Metric, slots);
+        gateways = section<uint32_t>(S::Gateway, slots);
+        vias = section<uint32_t>(S::Via, slots);
+        usableFlags = section<uint8_t>(S::Usable, slots);
+        groupOfSlot = section<uint32_t>(S::GroupOf, slots);
+        memberStart = section<uint32_t>(S::MemberStart, groups + 1);
+        members = section<uint32_t>(S::Members, memberStart[groups]);
+        bucketStart = section<uint32_t>(S::BucketStart, groups + 1);
+        buckets = section<uint16_t>(S::Buckets, bucketStart[groups]);
+        shifts = section<uint8_t>(S::Shift, groups);
+        backupStart = section<uint32_t>(S::BackupStart, groups + 1);
+        backups = section<uint32_t>(S::Backups, backupStart[groups]);
+        downCount = header->sections[S::Down].bytes / sizeof(uint32_t);
+        downAddrs = section<uint32_t>(S::Down, downCount);
+    }
+
+    uint32_t lookup(uint32_t addr) const { return fib.lookup(addr); }
+    void lookupBatch(const uint32_t* addrs, size_t n, uint32_t* out) const { fib.lookupBatch(addrs, n, out); }
+
+    Group group(uint32_t g) const {
+        return {members + memberStart[g], memberStart[g + 1] - memberStart[g],
+                buckets + bucketStart[g], bucketStart[g + 1] - bucketStart[g], shifts[g]};
+    }
+
+    uint32_t select(uint32_t g, uint32_t flowHash) const {
+        if (g == NO_ROUTE)
+            return NO_ROUTE;
+        auto usable = [this](uint32_t slot) { return usableFlags[slot] != 0; };
+        return selectFromGroup(group(g), flowHash, usable, [&] {
+            for (uint32_t i = backupStart[g]; i < backupStart[g + 1]; ++i)
+                if (usable(backups[i])) return backups[i];
+            return NO_ROUTE;
+        });
+    }
+
+    // Grupa prefiksu dokładnie takiego jak podany (wyszukiwanie binarne) albo NO_ROUTE
+    uint32_t exact(uint32_t key, int len) const {
+        key &= prefixMask(len);
+        size_t lo = 0, hi = header->prefixes;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (prefixKeys[mid] < key || (prefixKeys[mid] == key && prefixLens[mid] < len)) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo < header->prefixes && prefixKeys[lo] == key && prefixLens[lo] == len ? prefixGroups[lo] : NO_ROUTE;
+    }
+
+    template <class F>
+    void forEachPrefix(F f) const {
+        for (size_t i = 0; i < header->prefixes; ++i) f(prefixKeys[i], prefixLens[i], prefixGroups[i]);
+    }
+
+    template <class F>
+    void forEachDown(F f) const {
+        for (size_t i = 0; i < downCount; ++i) f(downAddrs[i]);
+    }
+
+    bool used(uint32_t slot) const { return prefixes[slot] != PREFIX_FREE; }
+    bool usable(uint32_t slot) const { return usableFlags[slot] != 0; }
+    bool resolved(uint32_t slot) const { return vias[slot] != NO_ROUTE; }
+    uint32_t network(uint32_t slot) const { return networks[slot]; }
+    int prefixLength(uint32_t slot) const { return prefixes[slot]; }
+    int32_t metric(uint32_t slot) const { return metrics[slot]; }
+    uint32_t gateway(uint32_t slot) const { return gateways[slot]; }
+    uint32_t groupOf(uint32_t slot) const { return groupOfSlot[slot]; }
+    uint32_t backup(uint32_t g) const { return backupStart[g] < backupStart[g + 1] ? backups[backupStart[g]] : NO_ROUTE; }
+    Group::Range backupSlots(uint32_t g) const { return {backups + backupStart[g], backups + backupStart[g + 1]}; }
+
+    Route route(uint32_t slot) const {
+        IPAddress gw(gateways[slot], 32);
+        return Route(IPAddress(networks[slot], prefixes[slot]), gw, metrics[slot],
+                     vias[slot] == NO_ROUTE ? gw : IPAddress(vias[slot], 32));
+    }
+
+    uint32_t slotCount() const { return header->slots; }
+    uint32_t groupCount() const { return header->groups; }
+    size_t size() const { return header->routes; }
+    size_t prefixCount() const { return header->prefixes; }
+    size_t fileSize() const { return file.size(); }
+    const char* data() const { return file.data(); }
+    string engineName() const { return string(header->engine, strnlen(header->engine, sizeof(header->engine))); }
+};
+
+// ------------------------- RoutingTable -------------------------
+// Numery generacji są unikalne w całym procesie, więc pamięć podręczna wątku może obsługiwać
+// wiele tablic routingu naraz bez ryzyka pomylenia wpisów
+inline uint64_t nextTableGeneration() {
+    static atomic<uint64_t> generation{0};
+    return ++generation;
+}
+
+// Suma liczników trafień pamięci podręcznych wszystkich wątków
+struct LookupCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t threads = 0;         // wątki, które mają teraz własną pamięć podręczną
+
+    double hitRatio() const { return hits + misses ? static_cast<double>(hits) / (hits + misses) : 0.0; }
+};
+
+// Rejestr pamięci podręcznych wątków. Liczniki działających wątków są sumowane przy odczycie,
+// a kończący się wątek (np. roboczy po 'flood') dopisuje swoje do sumy zakończonych.
+class LookupCacheRegistry {
+    mutex lock;
+    vector<const LookupCache*> live;
+    uint64_t retiredHits = 0;
+    uint64_t retiredMisses = 0;
+
+public:
+    static LookupCacheRegistry& instance() {
+        static LookupCacheRegistry registry;
+        return registry;
+    }
+
+    void attach(const LookupCache* cache) {
+        lock_guard<mutex> guard(lock);
+        live.push_back(cache);
+    }
+
+    void detach(const LookupCache* cache) {
+        lock_guard<mutex> guard(lock);
+        retiredHits += cache->hitCount();
+        retiredMisses += cache->missCount();
+        live.erase(find(live.begin(), live.end(), cache));
+    }
+
+    LookupCacheStats totals() {
+        lock_guard<mutex> guard(lock);
+        LookupCacheStats stats{retiredHits, retiredMisses, live.size()};
+        for (const LookupCache* cache : live) {
+            stats.hits += cache->hitCount();
+            stats.misses += cache->missCount();
+        }
+        return stats;
+    }
+};
+
+// Pamięć podręczna wyszukiwań bieżącego wątku
+inline LookupCache& threadLookupCache() {
+    struct Registered {
+        LookupCache cache;
+        Registered() { LookupCacheRegistry::instance().attach(&cache); }
+        ~Registered() { LookupCacheRegistry::instance().detach(&cache); }
+    };
+    thread_local Registered registered;
+    return registered.cache;
+}
+
+// Grupa ECMP: wszystkie trasy do jednego prefiksu. Przepływ wybiera członka przez tablicę
+// kubełków (odporne haszowanie): najstarsze bity hasha wskazują kubełek, a kubełek członka.
+// Dodanie członka zabiera kubełki tylko tym, którzy mają ich ponad przydział, a usunięcie
+// rozdaje wyłącznie kubełki usuniętego, więc przenosi się jedynie odpowiadająca im część
+// przepływów. Każda zmiana kosztuje O(liczba kubełków).
+class NextHopGroup {
+    static constexpr uint16_t ORPHAN = 0xFFFF;
+    static constexpr size_t MIN_BUCKETS = 64;
+    static constexpr size_t MAX_BUCKETS = 4096;
+    static constexpr size_t BUCKETS_PER_MEMBER = 8;
+
+    vector<uint32_t> members;   // sloty tras
+    vector<uint16_t> buckets;   // indeksy w members; pusta dla grupy z jednym członkiem
+    int shift = 32;
+
+    // Przydział kubełków członka i: po równo, reszta dla początkowych członków
+    size_t quota(size_t i) const {
+        return buckets.size() / members.size() + (i < buckets.size() % members.size() ? 1 : 0);
+    }
+
+    // Zabiera kubełki osieroconym i nadmiarowym właścicielom i oddaje je członkom poniżej przydziału
+    void rebalance() {
+        vector<size_t> owned(members.size(), 0);
+        for (uint16_t b : buckets)
+            if (b != ORPHAN) ++owned[b];
+        // Od końca - pierwszy kubełek (hash 0) zostaje przy pierwszym członku
+        for (auto b = buckets.rbegin(); b != buckets.rend(); ++b) {
+            if (*b != ORPHAN && owned[*b] > quota(*b)) {
+                --owned[*b];
+                *b = ORPHAN;
+            }
+        }
+        size_t next = 0;
+        for (uint16_t& b : buckets) {
+            if (b != ORPHAN) continue;
+            while (owned[next] >= quota(next)) ++next;
+            b = static_cast<uint16_t>(next);
+            ++owned[next];
+        }
+    }
+
+public:
+    static constexpr size_t MAX_MEMBERS = ORPHAN;
+
+    const vector<uint32_t>& slots() const { return members; }
+    const vector<uint16_t>& bucketTable() const { return buckets; }
+    int bucketShift() const { return shift; }
+    size_t size() const { return members.size(); }
+    size_t bucketCount() const { return buckets.size(); }
+
+    size_t memoryUsage() const {
+        return members.capacity() * sizeof(uint32_t) + buckets.capacity() * sizeof(uint16_t);
+    }
+
+    uint32_t select(uint32_t flowHash) const {
+        return buckets.empty() ? members[0] : members[buckets[flowHash >> shift]];
+    }
+
+    void add(uint32_t slot) {
+        members.push_back(slot);
+        if (members.size() == 1) return;
+        if (buckets.empty()) {
+            buckets.assign(MIN_BUCKETS, 0);
+            shift = 32 - __builtin_ctz(MIN_BUCKETS);
+        }
+        // Podwojenie powtarza każdy kubełek dwa razy - dotychczasowe przepływy zostają na miejscu
+        while (buckets.size() < members.size() * BUCKETS_PER_MEMBER && buckets.size() < MAX_BUCKETS) {
+            vector<uint16_t> doubled(buckets.size() * 2);
+            for (size_t i = 0; i < doubled.size(); ++i) doubled[i] = buckets[i / 2];
+            buckets.swap(doubled);
+            --shift;
+        }
+        rebalance();
+    }
+
+    // Usuwa członka o podanym indeksie; ostatni członek zajmuje jego miejsce
+    void removeAt(size_t i) {
+        uint16_t last = static_cast<uint16_t>(members.size() - 1);
+        members[i] = members.back();
+        members.pop_back();
+        if (members.size() <= 1) {
+            buckets.clear();
+            buckets.shrink_to_fit();
+            shift = 32;
+            return;
+        }
+        for (uint16_t& b : buckets) {
+            if (b == i) b = ORPHAN;
+            else if (b == last) b = static_cast<uint16_t>(i);
+        }
+        rebalance();
+    }
+
+    void clear() {
+        members.clear();
+        buckets.clear();
+        buckets.shrink_to_fit();
+        shift = 32;
+    }
+
+    // Odtworzenie grupy z migawki FIB razem z przydziałem kubełków - przepływy zostają na miejscu
+    void restore(const uint32_t* slots, size_t n, const uint16_t* table, size_t tableSize, int tableShift) {
+        members.assign(slots, slots + n);
+        buckets.assign(table, table + tableSize);
+        shift = tableShift;
+    }
+};
+
+// Tablica następnych skoków: każdy adres bramy występuje raz, a trasy odwołują się do niego
+// indeksem. Zmiana adresu lub stanu wpisu działa od razu dla wszystkich tras przez tę bramę.
+// Odwrotny indeks (lista slotów tras przez każdy skok, wpleciona w tablice depNext/depPrev)
+// pozwala wskazać trasy zależne od bramy bez przeglądania całej tablicy. Wpis przechowuje też
+// wynik rekurencyjnego rozwiązania bramy (wyznaczany przez RoutingState) razem z łańcuchem
+// adresów, które przy tym wyszukano - po zmianie trasy przelicza się tylko wpisy, których
+// łańcuch przechodzi przez zmieniony prefiks.
+class NextHopTable {
+    struct NextHop {
+        uint32_t addr;
+        uint32_t refs;      // liczba tras przez ten skok; 0 = wpis wolny
+        uint32_t first;     // pierwszy slot trasy na liście zależnych
+        uint32_t via;       // bezpośrednio osiągalny następny skok; NO_ROUTE gdy nierozwiązywalny
+        bool up;
+    };
+
+    vector<NextHop> hops;
+    vector<vector<uint32_t>> chains;           // adresy wyszukane przy rozwiązaniu każdego wpisu
+    multimap<uint32_t, uint32_t> chainIndex;   // adres z łańcucha -> wpis
+    vector<uint32_t> unresolved;               // nowe wpisy czekające na pierwsze rozwiązanie
+    set<uint32_t> downAddrs;                   // bramy zgłoszone jako niedziałające
+    uint64_t resolutions = 0;
+    vector<uint32_t> freeIds;
+    unordered_multimap<uint32_t, uint32_t> index;   // adres -> indeksy (po repoint() może być kilka)
+    vector<uint32_t> depNext, depPrev;         // sąsiedzi slotu trasy na liście jej skoku
+
+    void link(uint32_t id, uint32_t slot) {
+        if (slot >= depNext.size()) {
+            depNext.resize(slot + 1, NO_ROUTE);
+            depPrev.resize(slot + 1, NO_ROUTE);
+        }
+        depNext[slot] = hops[id].first;
+        depPrev[slot] = NO_ROUTE;
+        if (hops[id].first != NO_ROUTE) depPrev[hops[id].first] = slot;
+        hops[id].first = slot;
+    }
+
+    void eraseChain(uint32_t id) {
+        for (uint32_t addr : chains[id]) {
+            auto range = chainIndex.equal_range(addr);
+            for (auto it = range.first; it != range.second; ++it) {
+                if (it->second == id) {
+                    chainIndex.erase(it);
+                    break;
+                }
+            }
+        }
+        chains[id].clear();
+    }
+
+    void unlink(uint32_t id, uint32_t slot) {
+        if (depPrev[slot] != NO_ROUTE) depNext[depPrev[slot]] = depNext[slot];
+        else hops[id].first = depNext[slot];
+        if (depNext[slot] != NO_ROUTE) depPrev[depNext[slot]] = depPrev[slot];
+    }
+
+public:
+    // Indeks skoku dla adresu bramy trasy w danym slocie (nowy wpis, jeśli adres nie był jeszcze używany)
+    uint32_t acquire(uint32_t addr, uint32_t slot) {
+        auto it = index.find(addr);
+        uint32_t id;
+        if (it != index.end()) {
+            id = it->second;
+            ++hops[id].refs;
+        } else {
+            id = freeIds.empty() ? static_cast<uint32_t>(hops.size()) : freeIds.back();
+            index.emplace(addr, id);
+            if (!freeIds.empty()) {
+                freeIds.pop_back();
+                hops[id] = {addr, 1, NO_ROUTE, addr, addressUp(addr)};
+            } else {
+                hops.push_back({addr, 1, NO_ROUTE, addr, addressUp(addr)});
+                chains.emplace_back();
+            }
+            unresolved.push_back(id);
+        }
+        link(id, slot);
+        return id;
+    }
+
+    void release(uint32_t id, uint32_t slot) {
+        unlink(id, slot);
+        if (--hops[id].refs > 0)
+            return;
+        auto range = index.equal_range(hops[id].addr);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second == id) {
+                index.erase(it);
+                break;
+            }
+        }
+        eraseChain(id);
+        freeIds.push_back(id);
+    }
+
+    uint32_t address(uint32_t id) const { return hops[id].addr; }
+    uint32_t via(uint32_t id) const { return hops[id].via; }
+
+    // Czy trasy przez ten skok mogą przenosić ruch: brama działa i da się ją rozwiązać
+    bool usable(uint32_t id) const { return hops[id].up && hops[id].via != NO_ROUTE; }
+
+    // Stan bramy dotyczy adresu, a nie wpisu - obowiązuje też dla tras dodanych później
+    // i dla adresów pośrednich w rekurencji
+    bool addressUp(uint32_t addr) const { return downAddrs.count(addr) == 0; }
+    const set<uint32_t>& downAddresses() const { return downAddrs; }
+
+    void setResolution(uint32_t id, uint32_t via, vector<uint32_t>&& chain) {
+        eraseChain(id);
+        hops[id].via = via;
+        chains[id] = move(chain);
+        for (uint32_t addr : chains[id]) chainIndex.emplace(addr, id);
+        ++resolutions;
+    }
+
+    // Dopisuje do out wpisy, których łańcuch rozwiązania zawiera adres z zakresu [first, last]
+    void collectAffected(uint32_t first, uint32_t last, vector<uint32_t>& out) const {
+        for (auto it = chainIndex.lower_bound(first); it != chainIndex.end() && it->first <= last; ++it)
+            out.push_back(it->second);
+    }
+
+    // Dopisuje do out nowe wpisy (jeszcze nierozwiązane) i opróżnia ich listę
+    void takeUnresolved(vector<uint32_t>& out) {
+        for (uint32_t id : unresolved)
+            if (hops[id].refs > 0) out.push_back(id);
+        unresolved.clear();
+    }
+
+    uint64_t resolutionCount() const { return resolutions; }
+
+    // Przepina wszystkie trasy przez bramę 'from' na 'to' w czasie niezależnym od liczby tras.
+    // Jeśli 'to' ma już własny wpis, oba wpisy wskazują odtąd ten sam adres, a nowe trasy używają
+    // jednego z nich; kolejne przepięcie z 'to' przenosi wszystkie.
+    bool repoint(uint32_t from, uint32_t to) {
+        if (from == to)
+            return index.count(from) > 0;
+        auto range = index.equal_range(from);
+        if (range.first == range.second)
+            return false;
+        vector<uint32_t> moved;
+        for (auto it = range.first; it != range.second; ++it)
+            moved.push_back(it->second);
+        index.erase(range.first, range.second);
+        for (uint32_t id : moved) {
+            hops[id].addr = to;
+            hops[id].up = addressUp(to);
+            index.emplace(to, id);
+        }
+        return true;
+    }
+
+    bool contains(uint32_t addr) const { return index.count(addr) > 0; }
+
+    // Włącza lub wyłącza bramę niezależnie od liczby tras przez nią. Przegląda tylko wpisy
+    // skoków, bo po repoint() ten sam adres może mieć kilka wpisów. Zwraca liczbę tras przez bramę.
+    size_t setUp(uint32_t addr, bool up) {
+        if (up) downAddrs.erase(addr);
+        else downAddrs.insert(addr);
+        size_t routes = 0;
+        for (auto& hop : hops) {
+            if (hop.refs > 0 && hop.addr == addr) {
+                hop.up = up;
+                routes += hop.refs;
+            }
+        }
+        return routes;
+    }
+
+    // Wywołuje f(slot) dla każdej trasy przez bramę o podanym adresie
+    template <class F>
+    void forEachDependent(uint32_t addr, F&& f) const {
+        for (const auto& hop : hops)
+            if (hop.refs > 0 && hop.addr == addr)
+                for (uint32_t slot = hop.first; slot != NO_ROUTE; slot = depNext[slot])
+                    f(slot);
+    }
+
+    size_t size() const { return hops.size() - freeIds.size(); }
+
+    size_t memoryUsage() const {
+        size_t chainBytes = chains.capacity() * sizeof(vector<uint32_t>)
+                          + chainIndex.size() * (sizeof(pair<uint32_t, uint32_t>) + 4 * sizeof(void*));
+        for (const auto& c : chains) chainBytes += c.capacity() * sizeof(uint32_t);
+        return hops.capacity() * sizeof(NextHop) + chainBytes
+             + (freeIds.capacity() + depNext.capacity() + depPrev.capacity()) * sizeof(uint32_t)
+             + index.bucket_count() * sizeof(void*)
+             + index.size() * (sizeof(pair<uint32_t, uint32_t>) + sizeof(void*));
+    }
+};
+
+// Trasy w układzie kolumnowym: każde pole w osobnej tablicy indeksowanej slotem, brama jako
+// indeks w tablicy następnych skoków. Kolumny zajmują BYTES_PER_ROUTE bajtów na trasę (wcześniej
+// 16 w strukturze, a jako optional<Route> 24) - bez grup ECMP, kandydatów i silnika wyszukiwania,
+// które RoutingState::memoryUsage() liczy osobno. Ścieżka pakietu czyta tylko kolumnę nextHop,
+// więc jedna linia pamięci podręcznej mieści skoki 16 tras zamiast 4, a sieć, prefiks i metryka
+// są potrzebne wyłącznie przy zmianach tablicy i wypisywaniu.
+struct RouteColumns {
+    static constexpr size_t BYTES_PER_ROUTE = 2 * sizeof(uint32_t) + sizeof(int32_t) + sizeof(uint8_t);
+
+    vector<uint32_t> network;
+    vector<uint32_t> nextHop;   // NO_ROUTE dla wolnego slotu
+    vector<int32_t> metric;
+    vector<uint8_t> prefix;
+
+    size_t size() const { return nextHop.size(); }
+    bool used(uint32_t slot) const { return nextHop[slot] != NO_ROUTE; }
+
+    void reserve(size_t n) {
+        network.reserve(n);
+        nextHop.reserve(n);
+        metric.reserve(n);
+        prefix.reserve(n);
+    }
+
+    void set(uint32_t slot, uint32_t net, uint8_t len, uint32_t hop, int32_t met) {
+        if (slot == size()) {
+            network.push_back(net);
+            prefix.push_back(len);
+            nextHop.push_back(hop);
+            metric.push_back(met);
+        } else {
+            network[slot] = net;
+            prefix[slot] = len;
+            nextHop[slot] = hop;
+            metric[slot] = met;
+        }
+    }
+
+    size_t memoryUsage() const {
+        return (network.capacity() + nextHop.capacity()) * sizeof(uint32_t)
+             + metric.capacity() * sizeof(int32_t) + prefix.capacity() * sizeof(uint8_t);
+    }
+};
+
+// Zawartość tablicy routingu bez synchronizacji - RoutingTable trzyma dwie kopie
+class RoutingState {
+public:
+    // Trasa prefiksu w kolejności metryki; remis rozstrzyga numer dodania trasy, a nie numer
+    // slotu (zależny od tego, które sloty zwolniono wcześniej) ani brama (zmieniana przez gwmove
+    // bez przeglądania tras) - tablica odbudowana z punktu kontrolnego zachowuje tę kolejność
+    struct Candidate {
+        int metric;
+        uint32_t order;
+        uint32_t slot;
+
+        bool operator<(const Candidate& other) const {
+            return metric != other.metric ? metric < other.metric : order < other.order;
+        }
+    };
+
+    RouteColumns routes;              // sloty tras; zwolnione sloty są ponownie używane
+    NextHopTable nextHops;
+    vector<uint32_t> freeSlots;
+    vector<NextHopGroup> groups;      // grupy ECMP; zwolnione grupy są ponownie używane
+    vector<uint32_t> freeGroups;
+    vector<set<Candidate>> candidates;  // wszystkie trasy prefiksu grupy
+    vector<uint32_t> order;           // slot -> numer dodania trasy (Candidate::order)
+    uint32_t nextOrder = 0;
+    vector<uint32_t> backups;         // najlepsza trasa spoza grupy (za nią kolejni kandydaci)
+    unordered_map<IPAddress, uint32_t> prefixIndex;  // prefiks -> grupa
+    unique_ptr<LpmEngine> fib;        // prefiks -> grupa
+    uint64_t generation;              // zmienia się przy każdej zmianie wyniku wyszukiwania
+    shared_ptr<const FibSnapshot> mapped;  // otwarta migawka: do pierwszej zmiany odczyty idą przez nią
+
+    RoutingState() : fib(makeLpmEngine(ROUTER_DEFAULT_ENGINE)), generation(nextTableGeneration()) {}
+
+    static constexpr int MAX_RESOLUTION_DEPTH = 8;
+
+    // Zmiana trasy przelicza rozwiązania tylko tych bram, których łańcuch przechodzi przez
+    // zmieniony prefiks - ścieżka pakietu odczytuje gotowy wynik i nigdy nie schodzi rekurencyjnie
+    void add(const Route& r, uint64_t nextGeneration) {
+        materialize();
+        insert(r, nextGeneration);
+        resolveAffected(r.getNetwork());
+    }
+
+    // Wiele tras naraz: nowe prefiksy są zbierane osobno, a bramy rozwiązywane raz, na końcu.
+    // Gdy nowych prefiksów jest dużo względem tablicy, silnik wyszukiwania jest budowany jednym
+    // przejściem z gotowego zbioru zamiast N pojedynczych wstawień; kilka nowych prefiksów trafia
+    // do niego zwykłym wstawieniem. Przebudowa następuje więc dopiero po wzroście tablicy
+    // o ćwierć, a import wieloma paczkami ma koszt liniowy. Trasa ponad limit grupy ECMP jest
+    // pomijana (wynik: liczba pominiętych); inny wyjątek może przerwać wsad w połowie, więc
+    // RoutingTable::addRoutes odtwarza wtedy kopię (zob. tam).
+    size_t addBulk(const vector<Route>& batch, uint64_t nextGeneration) {
+        if (batch.empty())
+            return 0;
+        materialize();
+        PatriciaTrie added;
+        routes.reserve(routes.size() + batch.size());
+        prefixIndex.reserve(prefixIndex.size() + batch.size());
+
+        size_t skipped = 0;
+        for (const Route& r : batch) {
+            try {
+                insert(r, nextGeneration, &added);
+            } catch (const length_error&) {
+                ++skipped;
+            }
+        }
+
+        // Rozwiązania bram zmieniają się tylko w zakresie prefiksów z wsadu
+        vector<uint32_t> affected;
+        if (added.size() * 4 < fib->size()) {
+            added.forEach([&](uint32_t key, int len, uint32_t group) { fib->insert(key, len, group); });
+            for (const Route& r : batch) {
+                const IPAddress& net = r.getNetwork();
+                nextHops.collectAffected(net.getAddr(), net.getAddr() | ~prefixMask(net.getPrefix()), affected);
+            }
+        } else {
+            fib->forEach([&](uint32_t key, int len, uint32_t group) { added.insert(key, len, group); });
+            fib->assign(added);
+            nextHops.collectAffected(0, 0xFFFFFFFF, affected);
+        }
+        resolveAll(affected);
+        generation = nextGeneration;
+        return skipped;
+    }
+
+    // Kopia innego stanu - po dużej zmianie tańsza niż powtórzenie jej na drugiej kopii
+    void copyFrom(const RoutingState& other) {
+        routes = other.routes;
+        nextHops = other.nextHops;
+        freeSlots = other.freeSlots;
+        groups = other.groups;
+        freeGroups = other.freeGroups;
+        candidates = other.candidates;
+        order = other.order;
+        nextOrder = other.nextOrder;
+        backups = other.backups;
+        prefixIndex = other.prefixIndex;
+        fib = other.fib->clone();
+        generation = other.generation;
+        mapped = other.mapped;
+    }
+
+    // Zastępuje całą zawartość otwartą migawką; silnik wyszukiwania powstaje dopiero przy
+    // pierwszej zmianie, więc otwarcie nie zależy od rozmiaru tablicy
+    void attach(shared_ptr<const FibSnapshot> snapshot, uint64_t nextGeneration) {
+        *this = RoutingState();
+        mapped = move(snapshot);
+        generation = nextGeneration;
+    }
+
+    // Zapis migawki FIB. Silnik wyszukiwania jest niezależnie od bieżącego kompilowany do postaci
+    // DIR-24-8, bo jej tablice nie zawierają wskaźników. Plik powstaje pod nazwą tymczasową
+    // i jest podmieniany na końcu, więc procesy mające go zmapowanego nie widzą zapisu w połowie.
+    void save(const string& path) const {
+        using S = SnapshotHeader;
+        string temp = path + ".tmp";
+        ofstream out(temp, ios::binary | ios::trunc);
+        if (!out)
+            throw runtime_error("Nie można utworzyć pliku: " + temp);
+
+        S header{};
+        memcpy(header.magic, S::MAGIC, sizeof(header.magic));
+        header.version = S::VERSION;
+        header.byteOrder = S::ENDIAN_MARK;
+        uint64_t offset = 0;
+        auto put = [&](S::Section id, const void* data, size_t bytes) {
+            static const char padding[S::ALIGNMENT] = {};
+            out.write(padding, (S::ALIGNMENT - offset % S::ALIGNMENT) % S::ALIGNMENT);
+            offset += (S::ALIGNMENT - offset % S::ALIGNMENT) % S::ALIGNMENT;
+            header.sections[id] = {offset, bytes};
+            out.write(static_cast<const char*>(data), static_cast<streamsize>(bytes));
+            offset += bytes;
+        };
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        offset = sizeof(header);
+
+        if (mapped) {
+            // Migawka niezmieniona od otwarcia - zapisywana jest jej dokładna kopia
+            out.seekp(0);
+            out.write(mapped->data(), static_cast<streamsize>(mapped->fileSize()));
+        } else {
+            PatriciaTrie prefixes;
+            vector<uint32_t> keys, prefixGroups;
+            vector<uint8_t> lens;
+            vector<tuple<uint32_t, uint8_t, uint32_t>> sorted;
+            sorted.reserve(fib->size());
+            fib->forEach([&](uint32_t key, int len, uint32_t group) {
+                prefixes.insert(key, len, group);
+                sorted.emplace_back(key, static_cast<uint8_t>(len), group);
+            });
+            sort(sorted.begin(), sorted.end());
+            for (const auto& [key, len, group] : sorted) {
+                keys.push_back(key);
+                lens.push_back(len);
+                prefixGroups.push_back(group);
+            }
+            Dir24_8 compiled;
+            compiled.assign(prefixes);
+            Dir24_8::View tables = compiled.view();
+
+            size_t slots = routes.size();
+            vector<uint8_t> prefixColumn(routes.prefix), usableColumn(slots, 0);
+            vector<uint32_t> gatewayColumn(slots, 0), viaColumn(slots, NO_ROUTE), groupColumn(slots, NO_ROUTE);
+            for (uint32_t slot = 0; slot < slots; ++slot) {
+                if (!routes.used(slot)) {
+                    prefixColumn[slot] = FibSnapshot::PREFIX_FREE;
+                    continue;
+                }
+                uint32_t hop = routes.nextHop[slot];
+                gatewayColumn[slot] = nextHops.address(hop);
+                viaColumn[slot] = nextHops.via(hop);
+                usableColumn[slot] = nextHops.usable(hop);
+            }
+            vector<uint32_t> memberStart{0}, members, bucketStart{0}, backupStart{0}, backupList;
+            vector<uint16_t> buckets;
+            vector<uint8_t> shifts;
+            for (uint32_t g = 0; g < groups.size(); ++g) {
+                for (const auto& c : candidates[g]) groupColumn[c.slot] = g;
+                // Członkowie w kolejności kandydatów (z niej materialize() odtwarza numery dodania),
+                // a kubełki przenumerowane tak, że każdy przepływ trafia do tej samej trasy
+                const NextHopGroup& group = groups[g];
+                vector<pair<uint32_t, uint16_t>> position;   // (slot, indeks w migawce)
+                for (const auto& c : candidates[g]) {
+                    if (position.size() == group.size()) break;
+                    position.emplace_back(c.slot, static_cast<uint16_t>(position.size()));
+                    members.push_back(c.slot);
+                }
+                sort(position.begin(), position.end());
+                for (uint16_t b : group.bucketTable()) {
+                    uint32_t slot = group.slots()[b];
+                    buckets.push_back(lower_bound(position.begin(), position.end(), make_pair(slot, uint16_t(0)))->second);
+                }
+                memberStart.push_back(static_cast<uint32_t>(members.size()));
+                bucketStart.push_back(static_cast<uint32_t>(buckets.size()));
+                shifts.push_back(static_cast<uint8_t>(groups[g].bucketShift()));
+                forEachBackup(g, [&](uint32_t slot) { backupList.push_back(slot); });
+                backupStart.push_back(static_cast<uint32_t>(backupList.size()));
+            }
+            vector<uint32_t> down(nextHops.downAddresses().begin(), nextHops.downAddresses().end());
+
+            header.slots = static_cast<uint32_t>(slots);
+            header.routes = static_cast<uint32_t>(size());
+            header.groups = static_cast<uint32_t>(groups.size());
+            header.prefixes = static_cast<uint32_t>(keys.size());
+            strncpy(header.engine, fib->name(), sizeof(header.engine) - 1);
+
+            put(S::Tbl24, tables.tbl24, (size_t(1) << 24) * sizeof(uint32_t));
+            put(S::Tbl8, tables.tbl8, tables.tbl8Size * sizeof(uint32_t));
+            put(S::PrefixKey, keys.data(), keys.size() * sizeof(uint32_t));
+            put(S::PrefixLen, lens.data(), lens.size());
+            put(S::PrefixGroup, prefixGroups.data(), prefixGroups.size() * sizeof(uint32_t));
+            put(S::Network, routes.network.data(), slots * sizeof(uint32_t));
+            put(S::Prefix, prefixColumn.data(), slots);
+            put(S::Metric, routes.metric.data(), slots * sizeof(int32_t));
+            put(S::Gateway, gatewayColumn.data(), slots * sizeof(uint32_t));
+            put(S::Via, viaColumn.data(), slots * sizeof(uint32_t));
+            put(S::Usable, usableColumn.data(), slots);
+            put(S::GroupOf, groupColumn.data(), slots * sizeof(uint32_t));
+            put(S::MemberStart, memberStart.data(), memberStart.size() * sizeof(uint32_t));
+            put(S::Members, members.data(), members.size() * sizeof(uint32_t));
+            put(S::BucketStart, bucketStart.data(), bucketStart.size() * sizeof(uint32_t));
+            put(S::Buckets, buckets.data(), buckets.size() * sizeof(uint16_t));
+            put(S::Shift, shifts.data(), shifts.size());
+            put(S::BackupStart, backupStart.data(), backupStart.size() * sizeof(uint32_t));
+            put(S::Backups, backupList.data(), backupList.size() * sizeof(uint32_t));
+            put(S::Down, down.data(), down.size() * sizeof(uint32_t));
+
+            header.fileSize = offset;
+            out.seekp(0);
+            out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        out.close();
+        if (!out || ::rename(temp.c_str(), path.c_str()) != 0) {
+            ::remove(temp.c_str());
+            throw runtime_error("Nie można zapisać migawki: " + path);
+        }
+    }
+
+    // Przed pierwszą zmianą po otwarciu migawki jej zawartość jest odtwarzana w zwykłych
+    // strukturach: sloty i grupy (z kubełkami) zachowują numery, więc przepływy nie zmieniają tras
+    void materialize() {
+        if (!mapped)
+            return;
+        shared_ptr<const FibSnapshot> snapshot = move(mapped);
+        const FibSnapshot& m = *snapshot;
+
+        PatriciaTrie prefixes;
+        prefixIndex.reserve(m.prefixCount());
+        m.forEachPrefix([&](uint32_t key, int len, uint32_t group) {
+            prefixes.insert(key, len, group);
+            prefixIndex.emplace(IPAddress(key, len), group);
+        });
+        fib = makeLpmEngine(m.engineName());
+        fib->assign(prefixes);
+
+        uint32_t groupCount = m.groupCount();
+        groups.resize(groupCount);
+        candidates.resize(groupCount);
+        backups.resize(groupCount);
+        for (uint32_t g = 0; g < groupCount; ++g) {
+            FibSnapshot::Group view = m.group(g);
+            if (view.count == 0) {
+                freeGroups.push_back(g);
+                backups[g] = NO_ROUTE;
+                continue;
+            }
+            groups[g].restore(view.first, view.count, view.buckets, view.bucketCount, view.shift);
+            backups[g] = m.backup(g);
+        }
+
+        routes.reserve(m.slotCount());
+        for (uint32_t slot = 0; slot < m.slotCount(); ++slot) {
+            if (!m.used(slot)) {
+                routes.set(slot, 0, 0, NO_ROUTE, 0);
+                freeSlots.push_back(slot);
+                continue;
+            }
+            routes.set(slot, m.network(slot), static_cast<uint8_t>(m.prefixLength(slot)),
+                       nextHops.acquire(m.gateway(slot), slot), m.metric(slot));
+        }
+        // Migawka przechowuje członków i trasy zapasowe w kolejności kandydatów
+        order.assign(m.slotCount(), 0);
+        for (uint32_t g = 0; g < groupCount; ++g) {
+            auto restoreCandidate = [&](uint32_t slot) {
+                order[slot] = nextOrder++;
+                candidates[g].insert(candidate(slot));
+            };
+            for (uint32_t slot : m.group(g).slots()) restoreCandidate(slot);
+            for (uint32_t slot : m.backupSlots(g)) restoreCandidate(slot);
+        }
+
+        m.forEachDown([&](uint32_t addr) { nextHops.setUp(addr, false); });
+        vector<uint32_t> affected;
+        nextHops.collectAffected(0, 0xFFFFFFFF, affected);
+        resolveAll(affected);
+    }
+
+    bool remove(const IPAddress& network, uint64_t nextGeneration) {
+        materialize();
+        if (!erase(network, nextGeneration))
+            return false;
+        resolveAffected(network);
+        return true;
+    }
+
+    // Usuwa tylko trasę przez podaną bramę; ostatnia trasa usuwa cały prefiks
+    bool remove(const IPAddress& network, const IPAddress& gateway, uint64_t nextGeneration) {
+        materialize();
+        if (!eraseVia(network, gateway, nextGeneration))
+            return false;
+        resolveAffected(network);
+        return true;
+    }
+
+    // Prefiks z trasami przez obie bramy zostałby z dwiema trasami przez 'to' - zostaje lepsza
+    // z nich (przy równej metryce dotychczasowa trasa przez 'to'), druga jest usuwana
+    bool repointGateway(uint32_t from, uint32_t to) {
+        materialize();
+        if (!nextHops.contains(from))
+            return false;
+        if (from != to && nextHops.contains(to)) {
+            vector<pair<uint32_t, uint32_t>> duplicates;   // (grupa, slot do usunięcia)
+            nextHops.forEachDependent(from, [&](uint32_t slot) {
+                uint32_t group = prefixIndex.at(IPAddress(routes.network[slot], routes.prefix[slot]));
+                uint32_t other = findCandidate(group, IPAddress(to, 32));
+                if (other != NO_ROUTE)
+                    duplicates.emplace_back(group, routes.metric[slot] < routes.metric[other] ? other : slot);
+            });
+            for (auto [group, slot] : duplicates) {
+                IPAddress network(routes.network[slot], routes.prefix[slot]);
+                withdraw(group, slot);
+                freeSlot(slot);
+                resolveAffected(network);
+            }
+        }
+        nextHops.repoint(from, to);
+        vector<uint32_t> affected;
+        nextHops.collectAffected(from, from, affected);
+        nextHops.collectAffected(to, to, affected);
+        resolveAll(affected);
+        return true;
+    }
+
+    // Bramy rozwiązywane przez wyłączoną bramę też przestają przenosić ruch
+    size_t setGatewayUp(uint32_t gateway, bool up) {
+        materialize();
+        size_t routes = nextHops.setUp(gateway, up);
+        vector<uint32_t> affected;
+        nextHops.collectAffected(gateway, gateway, affected);
+        resolveAll(affected);
+        return routes;
+    }
+
+    // Rekurencyjne rozwiązanie bramy: najdłuższy prefiks obejmujący adres bramy wskazuje kolejną
+    // bramę, aż do sieci bezpośrednio podłączonej - trasy, której brama leży w jej własnej sieci -
+    // albo adresu bez żadnej trasy (też uznawanego za bezpośrednio osiągalny). Pętla, zbyt
+    // głęboka rekurencja lub wyłączona brama po drodze czynią bramę nierozwiązywalną.
+    void resolve(uint32_t hop) {
+        vector<uint32_t> chain;
+        uint32_t addr = nextHops.address(hop);
+        uint32_t via = NO_ROUTE;
+        vector<uint32_t> dependsOn;
+        for (int depth = 0; depth < MAX_RESOLUTION_DEPTH; ++depth) {
+            if (find(chain.begin(), chain.end(), addr) != chain.end())
+                break;
+            chain.push_back(addr);
+            if (depth > 0 && !nextHops.addressUp(addr))
+                break;
+            uint32_t group = fib->lookup(addr);
+            if (group == NO_ROUTE) {
+                via = addr;
+                break;
+            }
+            // Pierwszy kandydat przez działającą bramę - trasa grupy, a gdy żadna nie działa,
+            // zapasowa. Kolejność kandydatów, a nie członków grupy (tę zmienia usuwanie członka),
+            // więc wynik nie zależy od historii zmian. Bramy sprawdzonych tras (niedziałające
+            // i wybrana) trafiają do łańcucha, więc włączenie wcześniejszej lub awaria wybranej
+            // przelicza wpis; dalsze trasy nie wpływają na wynik.
+            uint32_t best = NO_ROUTE;
+            for (const auto& c : candidates[group]) {
+                uint32_t gateway = nextHops.address(routes.nextHop[c.slot]);
+                dependsOn.push_back(gateway);
+                if (nextHops.addressUp(gateway)) {
+                    best = c.slot;
+                    break;
+                }
+            }
+            if (best == NO_ROUTE)
+                best = candidates[group].begin()->slot;
+            uint32_t gateway = nextHops.address(routes.nextHop[best]);
+            if (((gateway ^ routes.network[best]) & prefixMask(routes.prefix[best])) == 0) {
+                // Brama sieci podłączonej nie jest rozwiązywana, ale jej zmiana może zmienić wynik
+                via = addr;
+                break;
+            }
+            addr = gateway;
+        }
+        dependsOn.insert(dependsOn.end(), chain.begin(), chain.end());
+        sort(dependsOn.begin(), dependsOn.end());
+        dependsOn.erase(unique(dependsOn.begin(), dependsOn.end()), dependsOn.end());
+        nextHops.setResolution(hop, via, move(dependsOn));
+    }
+
+    // Wpisy, których łańcuch przechodzi przez adres z sieci, plus wpisy nowe
+    void resolveAffected(const IPAddress& network) {
+        vector<uint32_t> affected;
+        nextHops.collectAffected(network.getAddr(), network.getAddr() | ~prefixMask(network.getPrefix()), affected);
+        resolveAll(affected);
+    }
+
+    // Wpisy są najpierw zbierane - rozwiązanie jednego nie może wpłynąć na wybór pozostałych
+    void resolveAll(vector<uint32_t>& affected) {
+        nextHops.takeUnresolved(affected);
+        sort(affected.begin(), affected.end());
+        affected.erase(unique(affected.begin(), affected.end()), affected.end());
+        for (uint32_t id : affected) resolve(id);
+    }
+
+    // Każdy prefiks pamięta wszystkie swoje trasy uporządkowane według metryki, a jego grupa ECMP
+    // zawiera tylko te o najlepszej metryce - wyszukiwanie nie porównuje metryk. Ta sama brama
+    // zastępuje dotychczasową trasę. Silnik wyszukiwania jest zmieniany jako pierwszy - jeśli
+    // zgłosi wyjątek, stan pozostaje nietknięty. Przy wczytywaniu wsadowym nowe prefiksy trafiają
+    // do 'pending', a do silnika dopiero później (zob. addBulk).
+    void insert(const Route& r, uint64_t nextGeneration, PatriciaTrie* pending = nullptr) {
+        const IPAddress& net = r.getNetwork();
+        auto found = prefixIndex.find(net);
+        uint32_t group;
+        if (found == prefixIndex.end()) {
+            group = freeGroups.empty() ? static_cast<uint32_t>(groups.size()) : freeGroups.back();
+            if (pending)
+                pending->insert(net.getAddr(), net.getPrefix(), group);
+            else
+                fib->insert(net.getAddr(), net.getPrefix(), group);
+            prefixIndex.emplace(net, group);
+            if (!freeGroups.empty()) {
+                freeGroups.pop_back();
+            } else {
+                groups.emplace_back();
+                candidates.emplace_back();
+                backups.push_back(NO_ROUTE);
+            }
+            generation = nextGeneration;
+        } else {
+            group = found->second;
+            uint32_t existing = findCandidate(group, r.getGateway());
+            if (existing != NO_ROUTE) {
+                withdraw(group, existing);
+                routes.metric[existing] = r.getMetric();
+                install(group, existing);
+                return;
+            }
+            if (candidates[group].size() == NextHopGroup::MAX_MEMBERS)
+                throw length_error("Zbyt wiele tras do jednej sieci.");
+        }
+
+        uint32_t slot = freeSlots.empty() ? static_cast<uint32_t>(routes.size()) : freeSlots.back();
+        routes.set(slot, net.getAddr(), static_cast<uint8_t>(net.getPrefix()),
+                   nextHops.acquire(r.getGateway().getAddr(), slot), r.getMetric());
+        if (!freeSlots.empty()) freeSlots.pop_back();
+        stamp(slot);
+        install(group, slot);
+    }
+
+    bool erase(const IPAddress& network, uint64_t nextGeneration) {
+        auto found = prefixIndex.find(network);
+        if (found == prefixIndex.end())
+            return false;
+
+        uint32_t group = found->second;
+        fib->erase(network.getAddr(), network.getPrefix());
+        prefixIndex.erase(found);
+        for (const auto& c : candidates[group])
+            freeSlot(c.slot);
+        candidates[group].clear();
+        groups[group].clear();
+        backups[group] = NO_ROUTE;
+        freeGroups.push_back(group);
+        generation = nextGeneration;
+        return true;
+    }
+
+    bool eraseVia(const IPAddress& network, const IPAddress& gateway, uint64_t nextGeneration) {
+        auto found = prefixIndex.find(network);
+        if (found == prefixIndex.end())
+            return false;
+
+        uint32_t group = found->second;
+        uint32_t slot = findCandidate(group, gateway);
+        if (slot == NO_ROUTE)
+            return false;
+        if (candidates[group].size() == 1)
+            return erase(network, nextGeneration);
+        withdraw(group, slot);
+        freeSlot(slot);
+        return true;
+    }
+
+    // Nowa trasa dostaje kolejny numer dodania; po wyczerpaniu numerów kandydaci każdej grupy
+    // są numerowani od nowa z zachowaniem kolejności
+    void stamp(uint32_t slot) {
+        if (nextOrder == UINT32_MAX) {
+            nextOrder = 0;
+            for (auto& prefixCandidates : candidates) {
+                set<Candidate> renumbered;
+                uint32_t n = 0;
+                for (const auto& c : prefixCandidates) {
+                    order[c.slot] = n;
+                    renumbered.insert(renumbered.end(), {c.metric, n++, c.slot});
+                }
+                prefixCandidates.swap(renumbered);
+                nextOrder = max(nextOrder, n);
+            }
+        }
+        if (slot >= order.size())
+            order.resize(slot + 1);
+        order[slot] = nextOrder++;
+    }
+
+    void freeSlot(uint32_t slot) {
+        nextHops.release(routes.nextHop[slot], slot);
+        routes.nextHop[slot] = NO_ROUTE;
+        freeSlots.push_back(slot);
+    }
+
+    Route route(uint32_t slot) const {
+        if (mapped)
+            return mapped->route(slot);
+        uint32_t hop = routes.nextHop[slot];
+        uint32_t via = nextHops.via(hop);
+        IPAddress gateway(nextHops.address(hop), 32);
+        return Route(IPAddress(routes.network[slot], routes.prefix[slot]), gateway, routes.metric[slot],
+                     via == NO_ROUTE ? gateway : IPAddress(via, 32));
+    }
+
+    uint32_t findCandidate(uint32_t group, const IPAddress& gateway) const {
+        for (const auto& c : candidates[group])
+            if (nextHops.address(routes.nextHop[c.slot]) == gateway.getAddr())
+                return c.slot;
+        return NO_ROUTE;
+    }
+
+    // Lepsza metryka zastępuje całą grupę ECMP, równa do niej dołącza, gorsza czeka w kandydatach
+    void install(uint32_t group, uint32_t slot) {
+        int metric = routes.metric[slot];
+        candidates[group].insert(candidate(slot));
+        NextHopGroup& g = groups[group];
+        int best = g.size() > 0 ? routes.metric[g.slots()[0]] : metric;
+        if (metric < best) g.clear();
+        if (metric <= best) g.add(slot);
+        updateBackup(group);
+    }
+
+    // Gdy z grupy odejdzie ostatnia najlepsza trasa, awansują trasy o następnej metryce -
+    // pierwsze elementy uporządkowanego zbioru kandydatów
+    void withdraw(uint32_t group, uint32_t slot) {
+        candidates[group].erase(candidate(slot));
+        NextHopGroup& g = groups[group];
+        const vector<uint32_t>& members = g.slots();
+        auto pos = find(members.begin(), members.end(), slot);
+        if (pos != members.end()) {
+            g.removeAt(pos - members.begin());
+            if (g.size() == 0 && !candidates[group].empty()) {
+                int best = candidates[group].begin()->metric;
+                for (auto c = candidates[group].begin(); c != candidates[group].end() && c->metric == best; ++c)
+                    g.add(c->slot);
+            }
+        }
+        updateBackup(group);
+    }
+
+    // Trasa zapasowa to pierwszy kandydat za trasami grupy, czyli najlepszy o gorszej metryce
+    void updateBackup(uint32_t group) {
+        const NextHopGroup& g = groups[group];
+        backups[group] = NO_ROUTE;
+        if (g.size() == 0)
+            return;
+        auto next = candidates[group].upper_bound({routes.metric[g.slots()[0]], UINT32_MAX, NO_ROUTE});
+        if (next != candidates[group].end())
+            backups[group] = next->slot;
+    }
+
+    // Trasy zapasowe grupy w kolejności metryki: kandydaci od trasy zapasowej do końca
+    template <class F>
+    void forEachBackup(uint32_t group, F f) const {
+        uint32_t backup = backups[group];
+        if (backup == NO_ROUTE)
+            return;
+        for (auto c = candidates[group].find(candidate(backup)); c != candidates[group].end(); ++c)
+            f(c->slot);
+    }
+
+    Candidate candidate(uint32_t slot) const { return {routes.metric[slot], order[slot], slot}; }
+
+    // Wszystkie trasy jako f(sieć, prefiks, brama, metryka), w każdym prefiksie w kolejności
+    // kandydatów: najpierw członkowie grupy ECMP, potem trasy zapasowe. Dodanie tras w tej
+    // kolejności do pustej tablicy odtwarza kolejność kandydatów (ale nie przydział kubełków).
+    template <class F>
+    void forEachRoute(F f) const {
+        if (mapped) {
+            for (uint32_t g = 0; g < mapped->groupCount(); ++g) {
+                auto emit = [&](uint32_t slot) {
+                    f(mapped->network(slot), mapped->prefixLength(slot), mapped->gateway(slot), mapped->metric(slot));
+                };
+                for (uint32_t slot : mapped->group(g).slots()) emit(slot);
+                for (uint32_t slot : mapped->backupSlots(g)) emit(slot);
+            }
+            return;
+        }
+        for (uint32_t g = 0; g < groups.size(); ++g) {
+            auto emit = [&](uint32_t slot) {
+                f(routes.network[slot], int(routes.prefix[slot]), nextHops.address(routes.nextHop[slot]), routes.metric[slot]);
+            };
+            for (const auto& c : candidates[g]) emit(c.slot);
+        }
+    }
+
+    template <class F>
+    void forEachDownGateway(F f) const {
+        if (mapped) mapped->forEachDown(f);
+        else for (uint32_t addr : nextHops.downAddresses()) f(addr);
+    }
+
+    // Slot trasy wybranej z grupy dla danego przepływu
+    uint32_t select(uint32_t group, uint32_t flowHash) const {
+        if (mapped)
+            return mapped->select(group, flowHash);
+        if (group == NO_ROUTE)
+            return NO_ROUTE;
+        auto usable = [this](uint32_t slot) { return nextHops.usable(routes.nextHop[slot]); };
+        return selectFromGroup(groups[group], flowHash, usable, [&] {
+            uint32_t found = NO_ROUTE;
+            forEachBackup(group, [&](uint32_t slot) {
+                if (found == NO_ROUTE && usable(slot)) found = slot;
+            });
+            return found;
+        });
+    }
+
+    uint32_t lookup(uint32_t dst) const {
+        return mapped ? mapped->lookup(dst) : fib->lookup(dst);
+    }
+
+    void lookupBatch(const uint32_t* dsts, size_t n, uint32_t* out) const {
+        if (mapped) mapped->lookupBatch(dsts, n, out);
+        else fib->lookupBatch(dsts, n, out);
+    }
+
+    uint32_t exact(const IPAddress& network) const {
+        if (mapped)
+            return mapped->exact(network.getAddr(), network.getPrefix());
+        auto found = prefixIndex.find(network);
+        return found == prefixIndex.end() ? NO_ROUTE : found->second;
+    }
+
+    template <class F>
+    void forEachPrefix(F f) const {
+        if (mapped) mapped->forEachPrefix(f);
+        else fib->forEach(f);
+    }
+
+    // Wywołuje f(slot) dla każdej trasy przez bramę; migawka nie ma odwrotnego indeksu i jest przeglądana
+    template <class F>
+    void forEachVia(uint32_t gateway, F f) const {
+        if (!mapped) {
+            nextHops.forEachDependent(gateway, f);
+            return;
+        }
+        for (uint32_t slot = 0; slot < mapped->slotCount(); ++slot)
+            if (mapped->used(slot) && mapped->gateway(slot) == gateway) f(slot);
+    }
+
+    uint32_t slotCount() const { return mapped ? mapped->slotCount() : static_cast<uint32_t>(routes.size()); }
+    bool used(uint32_t slot) const { return mapped ? mapped->used(slot) : routes.used(slot); }
+    bool usable(uint32_t slot) const { return mapped ? mapped->usable(slot) : nextHops.usable(routes.nextHop[slot]); }
+    bool resolved(uint32_t slot) const {
+        return mapped ? mapped->resolved(slot) : nextHops.via(routes.nextHop[slot]) != NO_ROUTE;
+    }
+
+    // Sloty należące do grup ECMP, czyli trasy aktualnie używane (pozostałe są zapasowe)
+    vector<bool> activeSlots() const {
+        vector<bool> active(slotCount(), false);
+        if (mapped) {
+            for (uint32_t g = 0; g < mapped->groupCount(); ++g)
+                for (uint32_t slot : mapped->group(g).slots()) active[slot] = true;
+        } else {
+            for (const auto& g : groups)
+                for (uint32_t slot : g.slots()) active[slot] = true;
+        }
+        return active;
+    }
+
+    // Zwraca grupę (nie slot trasy) - skład grupy może się zmieniać bez unieważniania pamięci podręcznej
+    uint32_t lookupCached(uint32_t dst) const {
+        LookupCache& cache = threadLookupCache();
+        uint32_t slot;
+        if (!cache.get(dst, generation, slot)) {
+            slot = lookup(dst);
+            cache.put(dst, generation, slot);
+        }
+        return slot;
+    }
+
+    size_t size() const { return mapped ? mapped->size() : routes.size() - freeSlots.size(); }
+
+    // Bez stron zmapowanej migawki - są współdzielone i podawane osobno
+    size_t memoryUsage() const {
+        size_t groupBytes = groups.capacity() * sizeof(NextHopGroup) + backups.capacity() * sizeof(uint32_t)
+                          + candidates.capacity() * sizeof(set<Candidate>) + order.capacity() * sizeof(uint32_t)
+                          + (routes.size() - freeSlots.size()) * (sizeof(Candidate) + 4 * sizeof(void*));
+        for (const auto& g : groups) groupBytes += g.memoryUsage();
+        return routes.memoryUsage() + groupBytes + nextHops.memoryUsage()
+             + (freeSlots.capacity() + freeGroups.capacity()) * sizeof(uint32_t)
+             + prefixIndex.bucket_count() * sizeof(void*)
+             + prefixIndex.size() * (sizeof(pair<IPAddress, uint32_t>) + sizeof(void*))
+             + fib->memoryUsage();
+    }
+};
+
+// Klasa reprezentująca tablicę routingu. Wyszukiwania są bezpieczne wątkowo i nie blokują się
+// nawzajem ani na zmianach tras; zmiany są serializowane między sobą.
+class RoutingTable {
+    LeftRight<RoutingState> state;
+public:
+    void addRoute(const Route& r) {
+        uint64_t generation = nextTableGeneration();
+        state.modify([&](RoutingState& s) { s.add(r, generation); });
+    }
+
+    // Dodaje wiele tras jedną zmianą tablicy (np. z pliku); zwraca liczbę pominiętych tras.
+    // Druga kopia dostaje gotowy wynik zamiast powtarzać wszystkie wstawienia, chyba że wsad
+    // jest mały względem tablicy - wtedy powtórzenie kosztuje mniej niż kopia całości.
+    // Wyjątek w środku wsadu (silnik wyszukiwania, brak pamięci) zostawiłby kopię w połowie
+    // zmienioną - jest ona wtedy odtwarzana z kopii, której zmiana jeszcze nie dotknęła.
+    size_t addRoutes(const vector<Route>& routes) {
+        if (routes.empty())
+            return 0;
+        uint64_t generation = nextTableGeneration();
+        const RoutingState* built = nullptr;
+        bool replay = false;
+        size_t skipped = 0;
+        state.modify([&](RoutingState& s) {
+            if (built && !replay) {
+                s.copyFrom(*built);
+            } else if (built) {
+                try {
+                    s.addBulk(routes, generation);
+                } catch (...) {
+                    s.copyFrom(*built);   // wsad jest już widoczny w pierwszej kopii
+                }
+            } else {
+                replay = routes.size() * 4 < s.size();
+                try {
+                    skipped = s.addBulk(routes, generation);
+                } catch (...) {
+                    state.read([&](const RoutingState& unchanged) { s.copyFrom(unchanged); });
+                    throw;
+                }
+                built = &s;
+            }
+        });
+        return skipped;
+    }
+
+    // Usuwa wszystkie trasy do podanej sieci; false gdy żadnej nie było
+    bool removeRoute(const IPAddress& network) {
+        uint64_t generation = nextTableGeneration();
+        return state.modify([&](RoutingState& s) { return s.remove(network, generation); });
+    }
+
+    // Usuwa jedną trasę z grupy ECMP; pozostałe przepływy zostają przy swoich bramach
+    bool removeRoute(const IPAddress& network, const IPAddress& gateway) {
+        uint64_t generation = nextTableGeneration();
+        return state.modify([&](RoutingState& s) { return s.remove(network, gateway, generation); });
+    }
+
+    // Przenosi wszystkie trasy z bramy 'from' na 'to' jedną zmianą w tablicy następnych skoków
+    bool repointGateway(const IPAddress& from, const IPAddress& to) {
+        return state.modify([&](RoutingState& s) { return s.repointGateway(from.getAddr(), to.getAddr()); });
+    }
+
+    // Wyłącza lub włącza bramę dla wszystkich tras przez nią naraz; zwraca liczbę tych tras
+    size_t setGatewayUp(const IPAddress& gateway, bool up) {
+        return state.modify([&](RoutingState& s) { return s.setGatewayUp(gateway.getAddr(), up); });
+    }
+
+    // Trasy przez bramę według odwrotnego indeksu tablicy następnych skoków
+    vector<Route> routesVia(const IPAddress& gateway) const {
+        return state.read([&](const RoutingState& s) {
+            vector<Route> via;
+            s.forEachVia(gateway.getAddr(), [&](uint32_t slot) { via.push_back(s.route(slot)); });
+            return via;
+        });
+    }
+
+    // Wszystkie trasy i niedziałające bramy (zob. RoutingState::forEachRoute) - z nich
+    // addRoutes i setGatewayUp odtwarzają tablicę, np. z punktu kontrolnego dziennika
+    template <class F, class G>
+    void forEachRoute(F route, G down) const {
+        state.read([&](const RoutingState& s) {
+            s.forEachRoute(route);
+            s.forEachDownGateway(down);
+        });
+    }
+
+    // Lista prefiksów w tablicy (każdy raz), np. do generowania ruchu testowego
+    vector<IPAddress> networks() const {
+        return state.read([](const RoutingState& s) {
+            vector<IPAddress> all;
+            s.forEachPrefix([&](uint32_t key, int len, uint32_t) { all.emplace_back(key, len); });
+            return all;
+        });
+    }
+
+    bool hasRoute(const IPAddress& network) const {
+        return state.read([&](const RoutingState& s) { return s.exact(network) != NO_ROUTE; });
+    }
+
+    // flowHash wybiera trasę spośród równorzędnych (ECMP) - pakiety jednego przepływu idą tą samą drogą
+    optional<Route> findRoute(const IPAddress& addr, uint32_t flowHash = 0) const {
+        return state.read([&](const RoutingState& s) -> optional<Route> {
+            uint32_t slot = s.select(s.lookupCached(addr.getAddr()), flowHash);
+            if (slot == NO_ROUTE)
+                return nullopt;
+            return s.route(slot);
+        });
+    }
+
+    // Wsadowe wyszukiwanie: dla n adresów docelowych zapisuje w slots indeksy tras
+    // (NO_ROUTE gdy brak trasy). Trasę odczytuje się przez routeAt(). Bez hashy
+    // przepływów (nullptr) wybierany jest pierwszy członek każdej grupy ECMP.
+    void findRoutes(const uint32_t* dsts, const uint32_t* flowHashes, size_t n, uint32_t* slots) const {
+        state.read([&](const RoutingState& s) {
+            s.lookupBatch(dsts, n, slots);
+            for (size_t i = 0; i < n; ++i)
+                slots[i] = s.select(slots[i], flowHashes ? flowHashes[i] : 0);
+        });
+    }
+
+    uint32_t findSlot(uint32_t dst, uint32_t flowHash = 0) const {
+        return state.read([&](const RoutingState& s) { return s.select(s.lookup(dst), flowHash); });
+    }
+
+    uint32_t findSlotCached(uint32_t dst, uint32_t flowHash = 0) const {
+        return state.read([&](const RoutingState& s) { return s.select(s.lookupCached(dst), flowHash); });
+    }
+
+    // Pusta, jeśli slot zwolniono po wyszukaniu
+    optional<Route> routeAt(uint32_t slot) const {
+        return state.read([&](const RoutingState& s) -> optional<Route> {
+            if (slot >= s.slotCount() || !s.used(slot))
+                return nullopt;
+            return s.route(slot);
+        });
+    }
+
+    // Rozmiar pamięci podręcznej wyszukiwań wątku wywołującego
+    void resizeCache(size_t entries) { threadLookupCache().resize(entries); }
+
+    // Zapisuje migawkę FIB do pliku (zob. RoutingState::save)
+    void save(const string& path) const {
+        state.read([&](const RoutingState& s) { s.save(path); });
+    }
+
+    // Zastępuje zawartość tablicy migawką z pliku; wyszukiwania działają od razu na zmapowanym pliku
+    void open(const string& path) {
+        auto snapshot = make_shared<const FibSnapshot>(path);
+        uint64_t generation = nextTableGeneration();
+        state.modify([&](RoutingState& s) { s.attach(snapshot, generation); });
+    }
+
+    // Przebudowuje bieżącą zawartość tablicy w innym silniku wyszukiwania
+    void setEngine(const string& name) {
+        makeLpmEngine(name);  // walidacja nazwy przed zmianą którejkolwiek kopii
+        uint64_t generation = nextTableGeneration();
+        state.modify([&](RoutingState& s) {
+            s.materialize();
+            unique_ptr<LpmEngine> next = makeLpmEngine(name);
+            next->assign(*s.fib);
+            s.fib = move(next);
+            s.generation = generation;
+        });
+    }
+
+    string engineName() const {
+        return state.read([](const RoutingState& s) {
+            return s.mapped ? "dir24 (migawka " + s.mapped->engineName() + ")" : string(s.fib->name());
+        });
+    }
+
+    size_t size() const {
+        return state.read([](const RoutingState& s) { return s.size(); });
+    }
+
+    // Obejmuje obie kopie tablicy
+    size_t memoryUsage() const {
+        return 2 * state.read([](const RoutingState& s) { return s.memoryUsage(); });
+    }
+
+    uint64_t updateCount() const { return state.updateCount(); }
+    double avgUpdateNanos() const { return state.avgUpdateNanos(); }
+
+    void printStats() const {
+        state.read([](const RoutingState& s) {
+            if (s.mapped) {
+                cout << "Liczba tras: " << s.size() << ", prefiksów: " << s.mapped->prefixCount() << "\n";
+                cout << "Migawka FIB zmapowana tylko do odczytu: " << s.mapped->fileSize() / 1024
+                     << " KB współdzielonych stron (pierwsza zmiana wczytuje ją do silnika "
+                     << s.mapped->engineName() << ")\n";
+                return;
+            }
+            size_t widest = 0, multipath = 0;
+            for (const auto& g : s.groups) {
+                widest = max(widest, g.size());
+                if (g.size() > 1) ++multipath;
+            }
+            cout << "Liczba tras: " << s.size() << ", prefiksów: " << s.fib->size() << "\n";
+            cout << "Prefiksy z wieloma trasami (ECMP): " << multipath << ", największa grupa: " << widest << "\n";
+            cout << "Bramy w tablicy następnych skoków: " << s.nextHops.size()
+                 << ", przeliczeń rozwiązań rekurencyjnych: " << s.nextHops.resolutionCount() << "\n";
+            if (s.size() > 0)
+                cout << "Pamięć jednej kopii na trasę: " << s.memoryUsage() / s.size() << " B (w tym kolumny FIB "
+                     << RouteColumns::BYTES_PER_ROUTE << " B)\n";
+            cout << "Silnik wyszukiwania: " << s.fib->name() << ", pamięć: " << s.fib->memoryUsage() / 1024 << " KB\n";
+        });
+        size_t capacity = threadLookupCache().capacity();
+        LookupCacheStats cache = LookupCacheRegistry::instance().totals();
+        cout << "Pamięć podręczna wyszukiwań: " << capacity << " wpisów, trafienia "
+             << cache.hits << ", chybienia " << cache.misses << " (" << cache.hitRatio() * 100
+             << "% trafień, suma ze wszystkich wątków, obecnie " << cache.threads << ")\n";
+        cout << "Aktualizacje: " << state.updateCount() << ", średnio " << state.avgUpdateNanos() / 1000
+             << " us, najdłużej " << state.maxUpdateNanos() / 1000 << " us\n";
+        cout << "Pamięć łącznie (dwie kopie tablicy): " << memoryUsage() / 1024 << " KB\n";
+    }
+
+    // Trasy z gorszą metryką niż najlepsza dla ich prefiksu są oznaczone jako zapasowe
+    void print() const {
+        vector<pair<Route, string>> sorted = state.read([](const RoutingState& s) {
+            vector<bool> active = s.activeSlots();
+            vector<pair<Route, string>> all;
+            for (uint32_t slot = 0; slot < s.slotCount(); ++slot) {
+                if (!s.used(slot)) continue;
+                string note = active[slot] ? "" : " (zapasowa)";
+                if (!s.usable(slot))
+                    note += s.resolved(slot) ? " (brama wyłączona)" : " (brama nierozwiązywalna)";
+                all.emplace_back(s.route(slot), note);
+            }
+            return all;
+        });
+
+        if (sorted.empty()) {
+            cout << "Tablica routingu jest pusta.\n";
+            return;
+        }
+
+        sort(sorted.begin(), sorted.end(), [](const pair<Route, string>& a, const pair<Route, string>& b) {
+            return a.first.getMetric() < b.first.getMetric();
+        });
+
+        cout << "Aktualna tablica routingu:\n";
+        for (const auto& r : sorted)
+            cout << "  " << r.first.toString() << r.second << endl;
+    }
+};
+
+// ------------------------- RouteLoader -------------------------
+inline bool isFieldSeparator(char c) {
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+// Kolejne pole wiersza rozdzielone spacjami lub tabulatorami; pusty widok na końcu wiersza
+// i na początku komentarza ('#')
+inline string_view nextField(string_view& line) {
+    size_t i = 0, n = line.size();
+    while (i < n && isFieldSeparator(line[i])) ++i;
+    if (i < n && line[i] == '#')
+        i = n;
+    size_t begin = i;
+    while (i < n && !isFieldSeparator(line[i])) ++i;
+    string_view field = line.substr(begin, i - begin);
+    line.remove_prefix(i);
+    return field;
+}
+
+// Wiersz pliku tras: "<sieć> <brama> <metryka>", jak argumenty polecenia add (słowo add na
+// początku jest dozwolone). Puste wiersze i komentarze '#' dają ParseError::Empty. 'limit' to
+// koniec bufora z wierszem (zob. parseIPv4).
+inline ParseError parseRouteLine(string_view line, Route& out, const char* limit = nullptr) {
+    if (!limit) limit = line.data() + line.size();
+    string_view net = nextField(line);
+    if (net.empty())
+        return ParseError::Empty;
+    if (net == "add")
+        net = nextField(line);
+    string_view gw = nextField(line);
+    string_view met = nextField(line);
+    if (gw.empty() || met.empty() || !nextField(line).empty())
+        return ParseError::FieldCount;
+
+    uint32_t network, gateway;
+    int prefix, metric;
+    ParseError error = parseCidr(net, network, prefix, limit);
+    if (error == ParseError::None)
+        error = parseIPv4(gw, gateway, limit);
+    if (error != ParseError::None)
+        return error;
+    auto parsed = from_chars(met.data(), met.data() + met.size(), metric);
+    if (parsed.ec != errc() || parsed.ptr != met.data() + met.size())
+        return ParseError::BadMetric;
+
+    out = Route(IPAddress(network, prefix), IPAddress(gateway, 32), metric);
+    return ParseError::None;
+}
+
+// Wynik wczytywania pliku tras
+struct RouteFileStats {
+    size_t bytes = 0;
+    size_t lines = 0;
+    size_t routes = 0;            // poprawne wiersze z trasą
+    size_t errors = 0;            // wiersze odrzucone przez parser
+    size_t skipped = 0;           // trasy odrzucone przez tablicę (limit grupy ECMP)
+    size_t firstErrorLine = 0;    // numer wiersza od 1; 0 gdy brak błędów
+    ParseError firstError = ParseError::None;
+    size_t threads = 0;
+    double parseSeconds = 0;
+    double buildSeconds = 0;
+};
+
+// Fragment pliku przetwarzany przez jeden wątek
+struct RouteChunk {
+    vector<Route> routes;
+    size_t lines = 0;
+    size_t errors = 0;
+    size_t firstErrorLine = 0;    // numer wiersza w obrębie fragmentu
+    ParseError firstError = ParseError::None;
+};
+
+inline void parseRouteChunk(string_view text, RouteChunk& chunk) {
+    chunk.routes.reserve(count(text.begin(), text.end(), '\n') + 1);
+    Route route(IPAddress(0, 0), IPAddress(0, 32), 0);
+    const char* limit = text.data() + text.size();
+    while (!text.empty()) {
+        size_t end = text.find('\n');
+        string_view line = text.substr(0, end);
+        text.remove_prefix(end == string_view::npos ? text.size() : end + 1);
+        ++chunk.lines;
+
+        ParseError error = parseRouteLine(line, route, limit);
+        if (error == ParseError::None) {
+            chunk.routes.push_back(route);
+        } else if (error != ParseError::Empty) {
+            if (chunk.errors++ == 0) {
+                chunk.firstErrorLine = chunk.lines;
+                chunk.firstError = error;
+            }
+        }
+    }
+}
+
+// Wczytuje plik tras: plik jest mapowany w pamięci i dzielony na fragmenty na granicach wierszy,
+// parsowanymi równolegle; trasy trafiają do tablicy jedną zmianą w kolejności z pliku, więc
+// późniejszy wiersz dla tej samej sieci i bramy nadpisuje metrykę wcześniejszego.
+inline RouteFileStats loadRouteFile(const string& path, RoutingTable& table,
+                                    size_t threads = thread::hardware_concurrency()) {
+    static constexpr size_t MIN_CHUNK = 1 << 20;
+
+    RouteFileStats stats;
+    auto start = chrono::steady_clock::now();
+    MappedFile file(path);
+    string_view text = file.view();
+    stats.bytes = text.size();
+    stats.threads = max<size_t>(1, min(threads, text.size() / MIN_CHUNK));
+
+    vector<string_view> pieces;
+    while (!text.empty()) {
+        size_t cut = pieces.size() + 1 == stats.threads ? text.size() : min(text.size(), stats.bytes / stats.threads);
+        cut = text.find('\n', cut > 0 ? cut - 1 : 0);
+        cut = cut == string_view::npos ? text.size() : cut + 1;
+        pieces.push_back(text.substr(0, cut));
+        text.remove_prefix(cut);
+    }
+
+    vector<RouteChunk> chunks(pieces.size());
+    vector<thread> workers;
+    for (size_t i = 1; i < pieces.size(); ++i)
+        workers.emplace_back([&, i] { parseRouteChunk(pieces[i], chunks[i]); });
+    if (!pieces.empty())
+        parseRouteChunk(pieces[0], chunks[0]);
+    for (auto& w : workers) w.join();
+
+    vector<Route> routes;
+    if (chunks.size() == 1) {
+        routes = move(chunks[0].routes);
+    } else {
+        size_t total = 0;
+        for (const auto& c : chunks) total += c.routes.size();
+        routes.reserve(total);
+        for (auto& c : chunks) {
+            routes.insert(routes.end(), c.routes.begin(), c.routes.end());
+            vector<Route>().swap(c.routes);
+        }
+    }
+    for (const auto& c : chunks) {
+        if (c.errors > 0 && stats.errors == 0) {
+            stats.firstErrorLine = stats.lines + c.firstErrorLine;
+            stats.firstError = c.firstError;
+        }
+        stats.lines += c.lines;
+        stats.errors += c.errors;
+    }
+    stats.routes = routes.size();
+    stats.parseSeconds = secondsSince(start);
+
+    start = chrono::steady_clock::now();
+    stats.skipped = table.addRoutes(routes);
+    stats.buildSeconds = secondsSince(start);
+    return stats;
+}
+
+// ------------------------- MrtImporter -------------------------
+// Import zrzutów tablic BGP w formacie MRT TABLE_DUMP_V2 (RFC 6396, np. RouteViews, RIPE RIS).
+// Plik jest czytany strumieniowo buforem stałego rozmiaru, a trasy trafiają do tablicy paczkami,
+// więc zużycie pamięci przez import nie zależy od wielkości pliku.
+
+inline uint16_t readBe16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] << 8 | p[1]);
+}
+
+inline uint32_t readBe32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) << 24 | static_cast<uint32_t>(p[1]) << 16 | static_cast<uint32_t>(p[2]) << 8 | p[3];
+}
+
+// Rekord MRT; treść wskazuje do bufora czytnika i jest ważna do następnego wywołania next()
+struct MrtRecord {
+    static constexpr size_t HEADER_BYTES = 12;
+    static constexpr uint16_t TABLE_DUMP_V2 = 13;
+    static constexpr uint16_t PEER_INDEX_TABLE = 1;
+    static constexpr uint16_t RIB_IPV4_UNICAST = 2;
+    static constexpr uint16_t RIB_IPV4_UNICAST_ADDPATH = 8;   // RFC 8050
+
+    uint32_t timestamp;
+    uint16_t type;
+    uint16_t subtype;
+    const uint8_t* body;
+    uint32_t length;
+};
+
+// Strumieniowy czytnik rekordów MRT. Bufor rośnie tylko dla rekordu większego od niego.
+class MrtReader {
+    static constexpr size_t BUFFER_BYTES = 1 << 20;
+    static constexpr size_t MAX_RECORD = 1 << 26;
+
+    ifstream in;
+    vector<uint8_t> buffer;
+    size_t begin = 0, end = 0;
+    size_t consumed = 0;
+
+    // Zapewnia co najmniej 'need' bajtów od 'begin'; false gdy plik skończył się wcześniej
+    bool fill(size_t need) {
+        if (end - begin >= need)
+            return true;
+        if (begin > 0) {
+            memmove(buffer.data(), buffer.data() + begin, end - begin);
+            end -= begin;
+            begin = 0;
+        }
+        if (need > buffer.size())
+            buffer.resize(need);
+        while (end < need && in) {
+            in.read(reinterpret_cast<char*>(buffer.data() + end), static_cast<streamsize>(buffer.size() - end));
+            end += static_cast<size_t>(in.gcount());
+        }
+        return end >= need;
+    }
+
+public:
+    explicit MrtReader(const string& path) : in(path, ios::binary), buffer(BUFFER_BYTES) {
+        if (!in)
+            throw runtime_error("Nie można otworzyć pliku: " + path);
+        fill(4);
+        const uint8_t* p = buffer.data();
+        const char* packer = nullptr;
+        if (end >= 3 && p[0] == 'B' && p[1] == 'Z' && p[2] == 'h') packer = "bzip2";
+        else if (end >= 2 && p[0] == 0x1F && p[1] == 0x8B) packer = "gzip";
+        else if (end >= 4 && p[0] == 0xFD && p[1] == '7' && p[2] == 'z' && p[3] == 'X') packer = "xz";
+        if (packer)
+            throw runtime_error("Plik " + path + " jest skompresowany (" + packer + ") - rozpakuj go przed importem.");
+    }
+
+    // Kolejny rekord; false na końcu pliku. 'truncated' mówi, czy plik urwał się w połowie rekordu.
+    bool next(MrtRecord& record, bool& truncated) {
+        truncated = false;
+        if (!fill(MrtRecord::HEADER_BYTES)) {
+            truncated = end > begin;
+            return false;
+        }
+        const uint8_t* h = buffer.data() + begin;
+        record.timestamp = readBe32(h);
+        record.type = readBe16(h + 4);
+        record.subtype = readBe16(h + 6);
+        record.length = readBe32(h + 8);
+        if (record.length > MAX_RECORD)
+            throw runtime_error("Rekord MRT ma " + to_string(record.length) + " bajtów - plik nie jest zrzutem MRT "
+                                "albo jest uszkodzony.");
+        size_t total = MrtRecord::HEADER_BYTES + record.length;
+        if (!fill(total)) {
+            truncated = true;
+            return false;
+        }
+        record.body = buffer.data() + begin + MrtRecord::HEADER_BYTES;
+        begin += total;
+        consumed += total;
+        return true;
+    }
+
+    size_t bytesRead() const { return consumed; }
+};
+
+// Ścieżka BGP z wpisu RIB: brama (NEXT_HOP) i długość AS_PATH, która staje się metryką trasy
+struct MrtPath {
+    uint32_t nextHop = 0;
+    bool hasNextHop = false;
+    int asPathLength = 0;
+};
+
+// Długość AS_PATH wg RFC 4271: AS_SET liczy się jako jeden AS, segmenty konfederacji wcale.
+// TABLE_DUMP_V2 zapisuje numery AS na 4 bajtach; false gdy segmenty nie wypełniają atrybutu.
+inline bool parseAsPath(const uint8_t* p, size_t n, size_t asBytes, int& length) {
+    length = 0;
+    while (n > 0) {
+        if (n < 2)
+            return false;
+        uint8_t segment = p[0];
+        size_t count = p[1];
+        size_t bytes = 2 + count * asBytes;
+        if (bytes > n)
+            return false;
+        if (segment == 2) length += static_cast<int>(count);        // AS_SEQUENCE
+        else if (segment == 1 && count > 0) length += 1;           // AS_SET
+        p += bytes;
+        n -= bytes;
+    }
+    return true;
+}
+
+// Atrybuty BGP wpisu RIB; false dla uszkodzonej listy atrybutów
+inline bool parseBgpAttributes(const uint8_t* p, size_t n, MrtPath& path) {
+    static constexpr uint8_t EXTENDED_LENGTH = 0x10;
+    static constexpr uint8_t AS_PATH = 2, NEXT_HOP = 3, MP_REACH_NLRI = 14;
+
+    path = MrtPath();
+    while (n > 0) {
+        if (n < 3)
+            return false;
+        uint8_t flags = p[0], type = p[1];
+        size_t header = flags & EXTENDED_LENGTH ? 4 : 3;
+        if (n < header)
+            return false;
+        size_t length = flags & EXTENDED_LENGTH ? readBe16(p + 2) : p[2];
+        if (n < header + length)
+            return false;
+        const uint8_t* value = p + header;
+
+        if (type == AS_PATH) {
+            // Starsze zrzuty przepisane z TABLE_DUMP mają numery 2-bajtowe
+            if (!parseAsPath(value, length, 4, path.asPathLength) && !parseAsPath(value, length, 2, path.asPathLength))
+                return false;
+        } else if (type == NEXT_HOP && length == 4) {
+            path.nextHop = readBe32(value);
+            path.hasNextHop = true;
+        } else if (type == MP_REACH_NLRI && !path.hasNextHop && length >= 5 && value[0] == 4) {
+            // W TABLE_DUMP_V2 skrócony do długości i adresu następnego skoku
+            path.nextHop = readBe32(value + 1);
+            path.hasNextHop = true;
+        }
+        p += header + length;
+        n -= header + length;
+    }
+    return true;
+}
+
+// Wynik importu zrzutu MRT
+struct MrtImportStats {
+    size_t bytes = 0;
+    size_t records = 0;
+    size_t otherRecords = 0;      // rekordy innych typów (IPv6, BGP4MP...) - pomijane
+    size_t malformed = 0;         // uszkodzone rekordy RIB
+    size_t prefixes = 0;
+    size_t entries = 0;           // wpisy RIB (jeden na prefiks i sąsiada BGP)
+    size_t noNextHop = 0;         // wpisy bez następnego skoku IPv4
+    size_t routes = 0;            // trasy przekazane do tablicy
+    size_t skipped = 0;           // trasy odrzucone przez tablicę (limit grupy ECMP)
+    size_t batches = 0;
+    size_t peakBatch = 0;
+    bool truncated = false;
+    double parseSeconds = 0;
+    double buildSeconds = 0;
+};
+
+// Importuje trasy IPv4 unicast ze zrzutu TABLE_DUMP_V2. Każdy wpis RIB staje się trasą z bramą
+// z NEXT_HOP (bez niego - z adresu sąsiada z PEER_INDEX_TABLE) i metryką równą długości AS_PATH,
+// więc ścieżki o najkrótszej AS_PATH tworzą grupę ECMP, a dłuższe czekają jako zapasowe.
+// Dla prefiksu zostaje najwyżej 'maxPaths' najlepszych ścieżek o różnych bramach (0 - wszystkie):
+// pełny zrzut ma dziesiątki sąsiadów na prefiks.
+inline MrtImportStats importMrtFile(const string& path, RoutingTable& table, size_t maxPaths = 4) {
+    static constexpr size_t BATCH_ROUTES = 1 << 19;
+
+    MrtImportStats stats;
+    auto start = chrono::steady_clock::now();
+    MrtReader reader(path);
+    vector<uint32_t> peers;                 // indeks sąsiada -> adres IPv4 (0 dla sąsiadów IPv6)
+    vector<pair<int, uint32_t>> paths;      // (długość AS_PATH, brama) wpisów jednego prefiksu
+    vector<Route> batch;
+    batch.reserve(BATCH_ROUTES);
+
+    auto flush = [&] {
+        auto buildStart = chrono::steady_clock::now();
+        stats.skipped += table.addRoutes(batch);
+        stats.buildSeconds += secondsSince(buildStart);
+        stats.peakBatch = max(stats.peakBatch, batch.size());
+        ++stats.batches;
+        batch.clear();
+    };
+
+    auto readPeers = [&](const uint8_t* p, size_t n) {
+        if (n < 6 || n < 8u + readBe16(p + 4))
+            return false;
+        size_t pos = 6u + readBe16(p + 4);
+        size_t count = readBe16(p + pos);
+        pos += 2;
+        peers.assign(count, 0);
+        for (size_t i = 0; i < count; ++i) {
+            if (pos + 5 > n)
+                return false;
+            uint8_t peerType = p[pos];
+            size_t addrBytes = peerType & 0x01 ? 16 : 4;
+            size_t asBytes = peerType & 0x02 ? 4 : 2;
+            if (pos + 5 + addrBytes + asBytes > n)
+                return false;
+            if (addrBytes == 4)
+                peers[i] = readBe32(p + pos + 5);
+            pos += 5 + addrBytes + asBytes;
+        }
+        return true;
+    };
+
+    auto readRib = [&](const uint8_t* p, size_t n, bool addPath) {
+        if (n < 5)
+            return false;
+        int prefix = p[4];
+        size_t prefixBytes = (static_cast<size_t>(prefix) + 7) / 8;
+        if (prefix > 32 || n < 5 + prefixBytes + 2)
+            return false;
+        uint32_t network = 0;
+        for (size_t i = 0; i < prefixBytes; ++i)
+            network |= static_cast<uint32_t>(p[5 + i]) << (24 - 8 * i);
+        size_t pos = 5 + prefixBytes;
+        size_t count = readBe16(p + pos);
+        pos += 2;
+
+        paths.clear();
+        size_t entryHeader = addPath ? 12 : 8;
+        MrtPath bgp;
+        for (size_t i = 0; i < count; ++i) {
+            if (pos + entryHeader > n)
+                return false;
+            uint16_t peer = readBe16(p + pos);
+            size_t attrBytes = readBe16(p + pos + entryHeader - 2);
+            pos += entryHeader;
+            if (pos + attrBytes > n || !parseBgpAttributes(p + pos, attrBytes, bgp))
+                return false;
+            pos += attrBytes;
+            ++stats.entries;
+
+            uint32_t gateway = bgp.hasNextHop ? bgp.nextHop : peer < peers.size() ? peers[peer] : 0;
+            if (gateway == 0) {
+                ++stats.noNextHop;
+                continue;
+            }
+            paths.emplace_back(bgp.asPathLength, gateway);
+        }
+        ++stats.prefixes;
+
+        // Najlepsze ścieżki, każda brama raz - ta sama brama w tablicy nadpisałaby metrykę
+        stable_sort(paths.begin(), paths.end(),
+                    [](const pair<int, uint32_t>& a, const pair<int, uint32_t>& b) { return a.first < b.first; });
+        size_t kept = 0;
+        for (size_t i = 0; i < paths.size() && (maxPaths == 0 || kept < maxPaths); ++i) {
+            bool seen = false;
+            for (size_t j = 0; j < i && !seen; ++j) seen = paths[j].second == paths[i].second;
+            if (seen)
+                continue;
+            batch.emplace_back(IPAddress(network, prefix), IPAddress(paths[i].second, 32), paths[i].first);
+            ++kept;
+        }
+        stats.routes += kept;
+        return true;
+    };
+
+    MrtRecord record;
+    while (reader.next(record, stats.truncated)) {
+        ++stats.records;
+        bool ok = true;
+        if (record.type != MrtRecord::TABLE_DUMP_V2)
+            ++stats.otherRecords;
+        else if (record.subtype == MrtRecord::PEER_INDEX_TABLE)
+            ok = readPeers(record.body, record.length);
+        else if (record.subtype == MrtRecord::RIB_IPV4_UNICAST)
+            ok = readRib(record.body, record.length, false);
+        else if (record.subtype == MrtRecord::RIB_IPV4_UNICAST_ADDPATH)
+            ok = readRib(record.body, record.length, true);
+        else
+            ++stats.otherRecords;
+        if (!ok)
+            ++stats.malformed;
+        if (batch.size() >= BATCH_ROUTES)
+            flush();
+    }
+    if (!batch.empty())
+        flush();
+    stats.bytes = reader.bytesRead();
+    stats.parseSeconds = secondsSince(start) - stats.buildSeconds;
+    return stats;
+}
+
+// ------------------------- RouteJournal -------------------------
+// Dziennik zmian tras (write-ahead) z punktami kontrolnymi. Każda zmiana jest dopisywana do
+// dziennika przed wykonaniem, a co CHECKPOINT_RECORDS zmian (i po wczytaniu całej tablicy)
+// zapisywany jest punkt kontrolny - lista tras i niedziałających bram, 13 B na trasę zamiast
+// tablic DIR-24-8 migawki FIB - po którym dziennik zaczyna się od nowa. Start odbudowuje
+// tablicę z najnowszego punktu kontrolnego i powtarza tylko zmiany zapisane po nim, więc czas
+// odtworzenia nie zależy od tego, jak długo router działał. Otwarcie migawki FIB trafia do
+// dziennika jako jej ścieżka, więc nie wymaga przeglądania tras.
+
+// Zmiana tablicy zapisywana w dzienniku; znaczenie pól zależy od rodzaju zmiany
+struct JournalRecord {
+    enum class Op : uint8_t { Add = 1, Remove, RemoveVia, GatewayMove, GatewayDown, GatewayUp, Open };
+
+    Op op;
+    uint32_t network = 0;   // sieć trasy albo dotychczasowa brama (GatewayMove)
+    uint8_t prefix = 0;
+    uint32_t gateway = 0;   // brama trasy, nowa brama (GatewayMove) albo brama zmieniająca stan
+    int32_t metric = 0;
+    string path = "";       // migawka FIB (Open)
+
+    // Bajty zmiany danego rodzaju w pliku, bez kodu i sumy kontrolnej; 0 - nieznany kod.
+    // Open ma tu tylko długość ścieżki - sama ścieżka zajmuje kolejne bajty.
+    static size_t payloadBytes(uint8_t op) {
+        switch (static_cast<Op>(op)) {
+            case Op::Add: return 13;
+            case Op::Remove: return 5;
+            case Op::RemoveVia: return 9;
+            case Op::GatewayMove: return 8;
+            case Op::GatewayDown:
+            case Op::GatewayUp: return 4;
+            case Op::Open: return 2;
+        }
+        return 0;
+    }
+
+    // Wykonuje zmianę na tablicy, tak jak odpowiadające jej polecenie
+    void apply(RoutingTable& table) const {
+        switch (op) {
+            case Op::Add: table.addRoute(Route(IPAddress(network, prefix), IPAddress(gateway, 32), metric)); break;
+            case Op::Remove: table.removeRoute(IPAddress(network, prefix)); break;
+            case Op::RemoveVia: table.removeRoute(IPAddress(network, prefix), IPAddress(gateway, 32)); break;
+            case Op::GatewayMove: table.repointGateway(IPAddress(network, 32), IPAddress(gateway, 32)); break;
+            case Op::GatewayDown: table.setGatewayUp(IPAddress(gateway, 32), false); break;
+            case Op::GatewayUp: table.setGatewayUp(IPAddress(gateway, 32), true); break;
+            case Op::Open: table.open(path); break;
+        }
+    }
+};
+
+// Wynik odtworzenia stanu przy starcie
+struct RecoveryStats {
+    string checkpoint;              // pusty, gdy nie było punktu kontrolnego
+    uint64_t checkpointSequence = 0;
+    size_t routes = 0;
+    size_t replayed = 0;            // zmiany z dziennika powtórzone po punkcie kontrolnym
+    size_t failed = 0;              // zmiany, które zgłosiły błąd (tak samo jak przy pierwszym wykonaniu)
+    size_t droppedBytes = 0;        // niekompletny lub uszkodzony koniec dziennika
+    bool missingChanges = false;    // dziennik zaczyna się później niż punkt kontrolny
+    string snapshot;                // migawka FIB otwarta przez powtórzoną zmianę
+    double loadSeconds = 0;
+    double replaySeconds = 0;
+};
+
+class RouteJournal {
+    static constexpr char MAGIC[8] = {'R', 'S', 'W', 'A', 'L', 0, 0, 0};
+    static constexpr char CHECKPOINT_MAGIC[8] = {'R', 'S', 'C', 'K', 'P', 0, 0, 0};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr uint32_t ENDIAN_MARK = 0x01020304;
+    static constexpr size_t HEADER_BYTES = sizeof(MAGIC) + 2 * sizeof(uint32_t) + sizeof(uint64_t);
+    static constexpr size_t CHECKSUM_BYTES = sizeof(uint32_t);
+    static constexpr size_t CHECKPOINT_HEADER_BYTES = sizeof(CHECKPOINT_MAGIC) + 2 * sizeof(uint32_t) + 2 * sizeof(uint64_t);
+    static constexpr size_t CHECKPOINT_ROUTE_BYTES = 13;      // sieć, prefiks, brama, metryka
+    static constexpr size_t CHECKPOINT_BATCH = 1 << 19;      // trasy dodawane jedną zmianą przy odtwarzaniu
+
+    string journalPath;
+    string checkpointPrefix;        // punkty kontrolne: <prefiks>.<numer ostatniej objętej zmiany>
+    ofstream out;
+    bool scanned = false;
+    uint64_t base = 0;              // numer zmiany, od której zaczyna się dziennik (bez niej)
+    uint64_t sequence = 0;          // numer ostatniej zapisanej zmiany
+    uint64_t checkpointSequence = 0;
+    string checkpointPath;          // najnowszy punkt kontrolny
+    vector<JournalRecord> tail;     // zmiany wczytane z dziennika, do powtórzenia przy starcie
+    size_t droppedBytes = 0;
+
+    // FNV-1a z numerem zmiany - wykrywa uszkodzony zapis i wpis pozostały ze starego dziennika
+    static uint32_t checksum(uint64_t seq, const uint8_t* bytes, size_t n) {
+        uint32_t h = 2166136261u;
+        auto mix = [&](uint8_t b) { h = (h ^ b) * 16777619u; };
+        for (int i = 0; i < 8; ++i) mix(static_cast<uint8_t>(seq >> (8 * i)));
+        for (size_t i = 0; i < n; ++i) mix(bytes[i]);
+        return h;
+    }
+
+    static size_t encode(const JournalRecord& r, uint64_t seq, uint8_t* bytes) {
+        size_t n = 0;
+        auto put = [&](const void* value, size_t size) { memcpy(bytes + n, value, size); n += size; };
+        bytes[n++] = static_cast<uint8_t>(r.op);
+        switch (r.op) {
+            case JournalRecord::Op::Add: put(&r.network, 4); put(&r.prefix, 1); put(&r.gateway, 4); put(&r.metric, 4); break;
+            case JournalRecord::Op::Remove: put(&r.network, 4); put(&r.prefix, 1); break;
+            case JournalRecord::Op::RemoveVia: put(&r.network, 4); put(&r.prefix, 1); put(&r.gateway, 4); break;
+            case JournalRecord::Op::GatewayMove: put(&r.network, 4); put(&r.gateway, 4); break;
+            case JournalRecord::Op::GatewayDown:
+            case JournalRecord::Op::GatewayUp: put(&r.gateway, 4); break;
+            case JournalRecord::Op::Open: {
+                uint16_t len = static_cast<uint16_t>(r.path.size());
+                put(&len, 2);
+                put(r.path.data(), len);
+                break;
+            }
+        }
+        uint32_t sum = checksum(seq, bytes, n);
+        put(&sum, CHECKSUM_BYTES);
+        return n;
+    }
+
+    // Dekoduje wpis z początku 'bytes'; 0 gdy wpis jest niekompletny albo uszkodzony
+    static size_t decode(const uint8_t* bytes, size_t n, uint64_t seq, JournalRecord& r) {
+        size_t payload = n > 0 ? JournalRecord::payloadBytes(bytes[0]) : 0;
+        if (payload > 0 && static_cast<JournalRecord::Op>(bytes[0]) == JournalRecord::Op::Open && n >= 3) {
+            uint16_t len;
+            memcpy(&len, bytes + 1, 2);
+            payload += len;
+        }
+        size_t total = 1 + payload + CHECKSUM_BYTES;
+        if (payload == 0 || n < total)
+            return 0;
+        uint32_t sum;
+        memcpy(&sum, bytes + 1 + payload, CHECKSUM_BYTES);
+        if (sum != checksum(seq, bytes, 1 + payload))
+            return 0;
+        r = JournalRecord{static_cast<JournalRecord::Op>(bytes[0])};
+        const uint8_t* p = bytes + 1;
+        auto get = [&](void* value, size_t size) { memcpy(value, p, size); p += size; };
+        switch (r.op) {
+            case JournalRecord::Op::Add: get(&r.network, 4); get(&r.prefix, 1); get(&r.gateway, 4); get(&r.metric, 4); break;
+            case JournalRecord::Op::Remove: get(&r.network, 4); get(&r.prefix, 1); break;
+            case JournalRecord::Op::RemoveVia: get(&r.network, 4); get(&r.prefix, 1); get(&r.gateway, 4); break;
+            case JournalRecord::Op::GatewayMove: get(&r.network, 4); get(&r.gateway, 4); break;
+            case JournalRecord::Op::GatewayDown:
+            case JournalRecord::Op::GatewayUp: get(&r.gateway, 4); break;
+            case JournalRecord::Op::Open: r.path.assign(reinterpret_cast<const char*>(p) + 2, payload - 2); break;
+        }
+        return total;
+    }
+
+    // Punkt kontrolny: nagłówek z liczbą tras i niedziałających bram, trasy w kolejności
+    // RoutingTable::forEachRoute i adresy niedziałających bram. Plik powstaje pod nazwą
+    // tymczasową i jest podmieniany na końcu, jak migawka FIB.
+    static void saveCheckpoint(const RoutingTable& table, const string& path) {
+        string temp = path + ".tmp";
+        {
+            ofstream file(temp, ios::binary | ios::trunc);
+            if (!file)
+                throw runtime_error("Nie można utworzyć pliku: " + temp);
+            vector<uint8_t> buffer(CHECKPOINT_HEADER_BYTES);
+            buffer.reserve(1 << 20);
+            vector<uint32_t> down;
+            uint64_t routes = 0;
+            auto put = [&](const void* value, size_t size) {
+                const uint8_t* bytes = static_cast<const uint8_t*>(value);
+                buffer.insert(buffer.end(), bytes, bytes + size);
+            };
+            table.forEachRoute(
+                [&](uint32_t network, int prefix, uint32_t gateway, int32_t metric) {
+                    uint8_t len = static_cast<uint8_t>(prefix);
+                    put(&network, 4); put(&len, 1); put(&gateway, 4); put(&metric, 4);
+                    ++routes;
+                    if (buffer.size() >= (1 << 20)) {
+                        file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<streamsize>(buffer.size()));
+                        buffer.clear();
+                    }
+                },
+                [&](uint32_t addr) { down.push_back(addr); });
+            for (uint32_t addr : down) put(&addr, 4);
+            file.write(reinterpret_cast<const char*>(buffer.data()), static_cast<streamsize>(buffer.size()));
+
+            uint32_t version = VERSION, mark = ENDIAN_MARK;
+            uint64_t downCount = down.size();
+            file.seekp(0);
+            file.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+            file.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            file.write(reinterpret_cast<const char*>(&mark), sizeof(mark));
+            file.write(reinterpret_cast<const char*>(&routes), sizeof(routes));
+            file.write(reinterpret_cast<const char*>(&downCount), sizeof(downCount));
+            if (!file.flush()) {
+                file.close();
+                ::remove(temp.c_str());
+                throw runtime_error("Nie można zapisać punktu kontrolnego: " + temp);
+            }
+        }
+        if (::rename(temp.c_str(), path.c_str()) != 0) {
+            ::remove(temp.c_str());
+            throw runtime_error("Nie można zapisać punktu kontrolnego: " + path);
+        }
+    }
+
+    // Odbudowuje tablicę (pustą) z punktu kontrolnego: najpierw stan bram, potem trasy paczkami
+    static void loadCheckpoint(const string& path, RoutingTable& table) {
+        MappedFile file(path);
+        const uint8_t* bytes = reinterpret_cast<const uint8_t*>(file.data());
+        size_t n = file.size();
+        if (n < CHECKPOINT_HEADER_BYTES || memcmp(bytes, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+            throw runtime_error("Plik " + path + " nie jest punktem kontrolnym dziennika.");
+        uint32_t version, mark;
+        uint64_t routes, downCount;
+        const uint8_t* p = bytes + sizeof(CHECKPOINT_MAGIC);
+        auto get = [&](void* value, size_t size) { memcpy(value, p, size); p += size; };
+        get(&version, sizeof(version));
+        get(&mark, sizeof(mark));
+        get(&routes, sizeof(routes));
+        get(&downCount, sizeof(downCount));
+        if (version != VERSION || mark != ENDIAN_MARK)
+            throw runtime_error("Punkt kontrolny " + path + " pochodzi z innej wersji programu lub innej architektury.");
+        if (routes > n / CHECKPOINT_ROUTE_BYTES || downCount > n / 4
+            || n != CHECKPOINT_HEADER_BYTES + routes * CHECKPOINT_ROUTE_BYTES + downCount * 4)
+            throw runtime_error("Punkt kontrolny " + path + " jest niekompletny.");
+
+        const uint8_t* downAddrs = p + routes * CHECKPOINT_ROUTE_BYTES;
+        for (uint64_t i = 0; i < downCount; ++i) {
+            uint32_t addr;
+            memcpy(&addr, downAddrs + 4 * i, 4);
+            table.setGatewayUp(IPAddress(addr, 32), false);
+        }
+        vector<Route> batch;
+        batch.reserve(min<uint64_t>(routes, CHECKPOINT_BATCH));
+        for (uint64_t i = 0; i < routes; ++i) {
+            uint32_t network, gateway;
+            uint8_t prefix;
+            int32_t metric;
+            get(&network, 4); get(&prefix, 1); get(&gateway, 4); get(&metric, 4);
+            if (prefix > 32)
+                throw runtime_error("Punkt kontrolny " + path + " jest uszkodzony.");
+            batch.emplace_back(IPAddress(network, prefix), IPAddress(gateway, 32), metric);
+            if (batch.size() == CHECKPOINT_BATCH) {
+                table.addRoutes(batch);
+                batch.clear();
+            }
+        }
+        table.addRoutes(batch);
+    }
+
+    // Punkty kontrolne na dysku: numer -> ścieżka
+    map<uint64_t, string> listCheckpoints() const {
+        map<uint64_t, string> found;
+        filesystem::path prefix(checkpointPrefix);
+        filesystem::path dir = prefix.has_parent_path() ? prefix.parent_path() : filesystem::path(".");
+        string stem = prefix.filename().string() + ".";
+        error_code ec;
+        for (const auto& entry : filesystem::directory_iterator(dir, ec)) {
+            string name = entry.path().filename().string();
+            if (name.size() <= stem.size() || name.compare(0, stem.size(), stem) != 0)
+                continue;
+            uint64_t seq;
+            const char* first = name.data() + stem.size();
+            auto parsed = from_chars(first, name.data() + name.size(), seq);
+            if (parsed.ec == errc() && parsed.ptr == name.data() + name.size())
+                found[seq] = checkpointPrefix + "." + to_string(seq);
+        }
+        return found;
+    }
+
+    // Zaczyna nowy, pusty dziennik od zmiany 'from'; podmieniany w całości jak plik migawki
+    void restart(uint64_t from) {
+        if (out.is_open())
+            out.close();
+        string temp = journalPath + ".tmp";
+        {
+            ofstream fresh(temp, ios::binary | ios::trunc);
+            uint32_t version = VERSION, mark = ENDIAN_MARK;
+            fresh.write(MAGIC, sizeof(MAGIC));
+            fresh.write(reinterpret_cast<const char*>(&version), sizeof(version));
+            fresh.write(reinterpret_cast<const char*>(&mark), sizeof(mark));
+            fresh.write(reinterpret_cast<const char*>(&from), sizeof(from));
+            if (!fresh.flush())
+                throw runtime_error("Nie można zapisać dziennika: " + temp);
+        }
+        if (::rename(temp.c_str(), journalPath.c_str()) != 0) {
+            ::remove(temp.c_str());
+            throw runtime_error("Nie można zapisać dziennika: " + journalPath);
+        }
+        base = sequence = from;
+        out.open(journalPath, ios::binary | ios::app);
+    }
+
+    // Odczytuje najnowszy punkt kontrolny i dziennik; niekompletny koniec dziennika (przerwany
+    // zapis) jest obcinany, żeby nowe wpisy nie trafiły za niego
+    void scan() {
+        if (scanned)
+            return;
+        scanned = true;
+        auto checkpoints = listCheckpoints();
+        if (!checkpoints.empty()) {
+            checkpointSequence = checkpoints.rbegin()->first;
+            checkpointPath = checkpoints.rbegin()->second;
+        }
+
+        error_code ec;
+        if (!filesystem::exists(journalPath, ec)) {
+            sequence = checkpointSequence;
+            restart(checkpointSequence);
+            return;
+        }
+
+        size_t valid = 0;
+        {
+            MappedFile file(journalPath);
+            const uint8_t* bytes = reinterpret_cast<const uint8_t*>(file.data());
+            size_t n = file.size();
+            uint32_t version = 0, mark = 0;
+            if (n >= HEADER_BYTES) {
+                memcpy(&version, bytes + sizeof(MAGIC), sizeof(version));
+                memcpy(&mark, bytes + sizeof(MAGIC) + sizeof(version), sizeof(mark));
+            }
+            if (n < HEADER_BYTES || memcmp(bytes, MAGIC, sizeof(MAGIC)) != 0)
+                throw runtime_error("Plik " + journalPath + " nie jest dziennikiem tras.");
+            if (version != VERSION || mark != ENDIAN_MARK)
+                throw runtime_error("Dziennik " + journalPath + " pochodzi z innej wersji programu lub innej architektury.");
+            memcpy(&base, bytes + sizeof(MAGIC) + 2 * sizeof(uint32_t), sizeof(base));
+
+            sequence = base;
+            valid = HEADER_BYTES;
+            JournalRecord r{JournalRecord::Op::Add};
+            while (size_t used = decode(bytes + valid, n - valid, sequence + 1, r)) {
+                tail.push_back(r);
+                valid += used;
+                ++sequence;
+            }
+            droppedBytes = n - valid;
+        }
+        if (sequence < checkpointSequence) {
+            // Cały dziennik jest objęty punktem kontrolnym - numery nowych wpisów muszą iść po nim
+            vector<JournalRecord>().swap(tail);
+            restart(checkpointSequence);
+            return;
+        }
+        if (droppedBytes > 0)
+            filesystem::resize_file(journalPath, valid);
+        out.open(journalPath, ios::binary | ios::app);
+    }
+
+public:
+    // Co tyle zmian zapisywany jest punkt kontrolny - tyle najwyżej jest powtarzanych przy starcie
+    static constexpr uint64_t CHECKPOINT_RECORDS = 1 << 16;
+
+    RouteJournal(string journal, string checkpoints)
+        : journalPath(move(journal)), checkpointPrefix(move(checkpoints)) {}
+
+    // Odbudowuje pustą tablicę z najnowszego punktu kontrolnego i powtarza zmiany z dziennika
+    // zapisane po nim
+    RecoveryStats recover(RoutingTable& table) {
+        scan();
+        RecoveryStats stats;
+        auto start = chrono::steady_clock::now();
+        if (!checkpointPath.empty()) {
+            loadCheckpoint(checkpointPath, table);
+            stats.checkpoint = checkpointPath;
+            stats.checkpointSequence = checkpointSequence;
+        }
+        stats.loadSeconds = secondsSince(start);
+        stats.missingChanges = base > checkpointSequence;
+        stats.droppedBytes = droppedBytes;
+
+        start = chrono::steady_clock::now();
+        uint64_t seq = base;
+        for (const JournalRecord& r : tail) {
+            if (++seq <= checkpointSequence)
+                continue;   // zmiana objęta już punktem kontrolnym (przerwa między jego zapisem a nowym dziennikiem)
+            try {
+                r.apply(table);
+                if (r.op == JournalRecord::Op::Open)
+                    stats.snapshot = r.path;
+            } catch (const exception&) {
+                ++stats.failed;
+            }
+            ++stats.replayed;
+        }
+        vector<JournalRecord>().swap(tail);
+        stats.replaySeconds = secondsSince(start);
+        stats.routes = table.size();
+        return stats;
+    }
+
+    // Dopisuje zmianę przed jej wykonaniem; wpis trafia do pliku od razu, więc przetrwa przerwanie
+    // procesu (ale nie awarię zasilania - dziennik nie wymusza zapisu na dysk)
+    void append(const JournalRecord& r) {
+        if (r.path.size() > UINT16_MAX)
+            throw length_error("Zbyt długa ścieżka migawki: " + r.path);
+        scan();
+        uint8_t fixed[32];
+        vector<uint8_t> variable(r.path.empty() ? 0 : sizeof(fixed) + r.path.size());
+        uint8_t* bytes = r.path.empty() ? fixed : variable.data();
+        size_t n = encode(r, sequence + 1, bytes);
+        out.write(reinterpret_cast<const char*>(bytes), static_cast<streamsize>(n));
+        if (!out.flush())
+            throw runtime_error("Nie można zapisać dziennika: " + journalPath);
+        ++sequence;
+    }
+
+    bool checkpointDue() const { return sequence - base >= CHECKPOINT_RECORDS; }
+
+    // Zapisuje bieżący stan jako punkt kontrolny, zaczyna pusty dziennik i usuwa starsze punkty.
+    // Przerwanie między zapisem punktu a nowym dziennikiem niczego nie psuje: przy starcie zmiany
+    // o numerach objętych punktem są pomijane.
+    string checkpoint(const RoutingTable& table) {
+        scan();
+        string path = checkpointPrefix + "." + to_string(sequence);
+        saveCheckpoint(table, path);
+        restart(sequence);
+        checkpointSequence = sequence;
+        checkpointPath = path;
+        for (const auto& old : listCheckpoints())
+            if (old.first != sequence)
+                ::remove(old.second.c_str());
+        return path;
+    }
+
+    uint64_t pendingChanges() const { return sequence - base; }
+};
+
+// ------------------------- Packet -------------------------
+// Numer protokołu IP dla nazwy protokołu (bez względu na wielkość liter) lub liczby; nieznane
+// nazwy dostają stały skrót nazwy, żeby różne protokoły trafiały do różnych przepływów
+inline uint8_t ipProtocolNumber(const string& proto) {
+    string name;
+    for (unsigned char c : proto) name += static_cast<char>(toupper(c));
+    if (name == "ICMP") return 1;
+    if (name == "TCP") return 6;
+    if (name == "UDP") return 17;
+    bool numeric = !name.empty() && all_of(name.begin(), name.end(), [](unsigned char c) { return isdigit(c) != 0; });
+    if (numeric && name.size() <= 3 && stoi(name) < 256)
+        return static_cast<uint8_t>(stoi(name));
+    uint8_t h = 0;
+    for (char c : name) h = static_cast<uint8_t>(h * 31 + c);
+    return h;
+}
+
+// Klasa reprezentująca pakiet
+class Packet {
+    IPAddress source;
+    IPAddress destination;
+    string protocol;
+    uint8_t protocolNumber;
+public:
+    Packet(const IPAddress& src, const IPAddress& dst, const string& proto)
+        : source(src), destination(dst), protocol(proto), protocolNumber(ipProtocolNumber(proto)) {}
+
+    const IPAddress& getSource() const { return source; }
+    const IPAddress& getDestination() const { return destination; }
+    const string& getProtocol() const { return protocol; }
+    uint8_t getProtocolNumber() const { return protocolNumber; }
+
+    string toString() const {
+        ostringstream oss;
+        oss << "Pakiet od " << source.toString()
+            << " do " << destination.toString()
+            << " [" << protocol << "]";
+        return oss.str();
+    }
+};
+
+// ------------------------- Rings -------------------------
+// Krótkie oczekiwanie aktywne; na jednym rdzeniu lepiej oddać procesor niż kręcić się w pętli
+inline void cpuRelax(unsigned& spins) {
+    if (++spins < 64) {
+#if ROUTER_X86_SIMD
+        _mm_pause();
+#endif
+    } else {
+        spins = 0;
+        this_thread::yield();
+    }
+}
+
+// Licznik aktualizowany tylko przez jeden wątek, ale czytany przez inne (np. statystyki)
+inline void bumpCounter(atomic<uint64_t>& counter, uint64_t n) {
+    counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+// Ograniczony bufor cykliczny bez blokad: jeden producent, jeden konsument. Indeksy producenta
+// i konsumenta leżą na osobnych liniach pamięci podręcznej, a każda strona pamięta ostatnio
+// widziany indeks drugiej, więc odczyt cudzej linii następuje tylko gdy bufor wydaje się
+// pełny (lub pusty). Elementy przenoszone są paczkami.
+template <class T>
+class SpscRing {
+    static_assert(is_trivially_copyable_v<T>, "Pierścień przenosi uchwyty, a nie obiekty z zasobami.");
+
+    struct alignas(64) Producer {
+        atomic<size_t> tail{0};
+        size_t cachedHead = 0;
+        atomic<uint64_t> enqueued{0};
+        atomic<uint64_t> rejected{0};   // elementy, które się nie zmieściły
+        atomic<size_t> highWater{0};    // największa zaobserwowana zajętość
+    };
+    struct alignas(64) Consumer {
+        atomic<size_t> head{0};
+        size_t cachedTail = 0;
+        atomic<uint64_t> dequeued{0};
+    };
+
+    Producer prod;
+    Consumer cons;
+    vector<T> slots;
+    size_t mask;
+
+public:
+    // Pojemność zaokrąglana w górę do potęgi dwójki
+    explicit SpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
+    }
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    // Wstawia tyle elementów z paczki, ile się zmieści; zwraca ich liczbę
+    size_t enqueueBurst(const T* items, size_t n) {
+        size_t tail = prod.tail.load(memory_order_relaxed);
+        size_t free = slots.size() - (tail - prod.cachedHead);
+        if (free < n) {
+            prod.cachedHead = cons.head.load(memory_order_acquire);
+            free = slots.size() - (tail - prod.cachedHead);
+        }
+        size_t count = min(n, free);
+
+        size_t first = tail & mask;
+        size_t part = min(count, slots.size() - first);
+        copy(items, items + part, slots.begin() + first);
+        copy(items + part, items + count, slots.begin());
+        prod.tail.store(tail + count, memory_order_release);
+
+        bumpCounter(prod.enqueued, count);
+        if (count < n) bumpCounter(prod.rejected, n - count);
+        size_t used = tail + count - prod.cachedHead;
+        if (used > prod.highWater.load(memory_order_relaxed)) prod.highWater.store(used, memory_order_relaxed);
+        return count;
+    }
+
+    // Pobiera do max elementów; zwraca ich liczbę
+    size_t dequeueBurst(T* out, size_t max) {
+        size_t head = cons.head.load(memory_order_relaxed);
+        size_t available = cons.cachedTail - head;
+        if (available < max) {
+            cons.cachedTail = prod.tail.load(memory_order_acquire);
+            available = cons.cachedTail - head;
+        }
+        size_t count = min(max, available);
+
+        size_t first = head & mask;
+        size_t part = min(count, slots.size() - first);
+        copy(slots.begin() + first, slots.begin() + first + part, out);
+        copy(slots.begin(), slots.begin() + (count - part), out + part);
+        cons.head.store(head + count, memory_order_release);
+
+        bumpCounter(cons.dequeued, count);
+        return count;
+    }
+
+    // Przybliżona zajętość - druga strona może ją właśnie zmieniać
+    size_t occupancy() const {
+        size_t head = cons.head.load(memory_order_acquire);
+        return prod.tail.load(memory_order_acquire) - head;
+    }
+
+    size_t capacity() const { return slots.size(); }
+    size_t highWater() const { return prod.highWater.load(memory_order_relaxed); }
+    uint64_t enqueuedCount() const { return prod.enqueued.load(memory_order_relaxed); }
+    uint64_t dequeuedCount() const { return cons.dequeued.load(memory_order_relaxed); }
+    uint64_t rejectedCount() const { return prod.rejected.load(memory_order_relaxed); }
+};
+
+// Ograniczony bufor cykliczny bez blokad: wielu producentów, jeden konsument. Producent
+// rezerwuje miejsce przez CAS na prodHead, wpisuje elementy i publikuje je, przesuwając
+// prodTail - w kolejności rezerwacji, więc czeka na producentów, którzy zarezerwowali wcześniej.
+template <class T>
+class MpscRing {
+    static_assert(is_trivially_copyable_v<T>, "Pierścień przenosi uchwyty, a nie obiekty z zasobami.");
+
+    struct alignas(64) Index {
+        atomic<size_t> value{0};
+    };
+
+    Index prodHead, prodTail, consHead;
+    struct alignas(64) Counters {
+        atomic<uint64_t> enqueued{0};
+        atomic<uint64_t> rejected{0};
+    } prodStats;
+    atomic<uint64_t> dequeued{0};
+    vector<T> slots;
+    size_t mask;
 
-// ------------------------- IPAddress -------------------------
-// Klasa reprezentująca adres IP
-class IPAddress {
-    uint32_t addr;
-    int prefix;
 public:
-    // Konstruktor z parametrem CIDR (adres IP + prefiks)
-    explicit IPAddress(const string& cidr) {
-        size_t slash = cidr.find('/');
-        string ip = cidr.substr(0, slash);
-        prefix = (slash == string::npos ? 32 : stoi(cidr.substr(slash + 1)));
-        addr = ipToUint(ip) & maskFromPrefix(prefix);
+    explicit MpscRing(size_t capacity) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        slots.resize(size);
+        mask = size - 1;
     }
 
-    bool matches(const IPAddress& other) const {
-        uint32_t mask = maskFromPrefix(prefix);
-        return (other.addr & mask) == addr;
+    MpscRing(const MpscRing&) = delete;
+    MpscRing& operator=(const MpscRing&) = delete;
+
+    size_t enqueueBurst(const T* items, size_t n) {
+        size_t head = prodHead.value.load(memory_order_relaxed);
+        size_t count;
+        do {
+            size_t free = slots.size() - (head - consHead.value.load(memory_order_acquire));
+            count = min(n, free);
+            if (count == 0) break;
+        } while (!prodHead.value.compare_exchange_weak(head, head + count, memory_order_relaxed));
+
+        if (count > 0) {
+            size_t first = head & mask;
+            size_t part = min(count, slots.size() - first);
+            copy(items, items + part, slots.begin() + first);
+            copy(items + part, items + count, slots.begin());
+
+            unsigned spins = 0;
+            while (prodTail.value.load(memory_order_acquire) != head)
+                cpuRelax(spins);
+            prodTail.value.store(head + count, memory_order_release);
+            prodStats.enqueued.fetch_add(count, memory_order_relaxed);
+        }
+        if (count < n) prodStats.rejected.fetch_add(n - count, memory_order_relaxed);
+        return count;
     }
 
-    int getPrefix() const { return prefix; }
+    size_t dequeueBurst(T* out, size_t max) {
+        size_t head = consHead.value.load(memory_order_relaxed);
+        size_t count = min(max, prodTail.value.load(memory_order_acquire) - head);
 
-    string toString() const {
-        ostringstream oss;
-        oss << ((addr >> 24) & 0xFF) << '.' << ((addr >> 16) & 0xFF) << '.' << ((addr >> 8) & 0xFF) << '.' << (addr & 0xFF) << '/' << prefix;
-        return oss.str();
+        size_t first = head & mask;
+        size_t part = min(count, slots.size() - first);
+        copy(slots.begin() + first, slots.begin() + first + part, out);
+        copy(slots.begin(), slots.begin() + (count - part), out + part);
+        consHead.value.store(head + count, memory_order_release);
+
+        bumpCounter(dequeued, count);
+        return count;
     }
 
-    bool operator==(const IPAddress& other) const {
-        return addr == other.addr && prefix == other.prefix;
+    size_t occupancy() const {
+        size_t head = consHead.value.load(memory_order_acquire);
+        return prodTail.value.load(memory_order_acquire) - head;
     }
+
+    size_t capacity() const { return slots.size(); }
+    uint64_t enqueuedCount() const { return prodStats.enqueued.load(memory_order_relaxed); }
+    uint64_t dequeuedCount() const { return dequeued.load(memory_order_relaxed); }
+    uint64_t rejectedCount() const { return prodStats.rejected.load(memory_order_relaxed); }
 };
 
-namespace std {
-    template <>
-    struct hash<IPAddress> {
-        size_t operator()(const IPAddress& ip) const {
-            return hash<string>()(ip.toString());
+// ------------------------- ToeplitzHash -------------------------
+// Hash Toeplitza (jak w RSS kart sieciowych) po krotce źródło, cel, protokół. Dla każdej pozycji
+// bajtu wejścia i każdej jego wartości wkład do wyniku jest policzony z góry, więc hash to
+// XOR dziewięciu odczytów z tablicy - również w wersji wektorowej, gdzie robią to gathery.
+class ToeplitzHash {
+    static constexpr int INPUT_BYTES = 9;
+    uint32_t table[INPUT_BYTES * 256];
+
+#if ROUTER_X86_SIMD
+    __attribute__((target("avx2")))
+    size_t hashBatchAvx2(const uint32_t* src, const uint32_t* dst, const uint32_t* proto, size_t n, uint32_t* out) const {
+        const int* t = reinterpret_cast<const int*>(table);
+        const __m256i lowByte = _mm256_set1_epi32(0xFF);
+        size_t i = 0;
+        for (; i + 8 <= n; i += 8) {
+            __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+            __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+            __m256i p = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(proto + i));
+            __m256i h = _mm256_i32gather_epi32(t + 8 * 256, _mm256_and_si256(p, lowByte), 4);
+            for (int k = 0; k < 4; ++k) {
+                __m256i sb = _mm256_and_si256(_mm256_srl_epi32(s, _mm_cvtsi32_si128(24 - 8 * k)), lowByte);
+                __m256i db = _mm256_and_si256(_mm256_srl_epi32(d, _mm_cvtsi32_si128(24 - 8 * k)), lowByte);
+                h = _mm256_xor_si256(h, _mm256_i32gather_epi32(t + k * 256, sb, 4));
+                h = _mm256_xor_si256(h, _mm256_i32gather_epi32(t + (4 + k) * 256, db, 4));
+            }
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), h);
         }
-    };
-}
+        return i;
+    }
+
+    __attribute__((target("avx512f")))
+    size_t hashBatchAvx512(const uint32_t* src, const uint32_t* dst, const uint32_t* proto, size_t n, uint32_t* out) const {
+        const __m512i lowByte = _mm512_set1_epi32(0xFF);
+        const __m512i zero = _mm512_setzero_si512();
+        const __mmask16 all = 0xFFFF;
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m512i s = _mm512_loadu_si512(src + i);
+            __m512i d = _mm512_loadu_si512(dst + i);
+            __m512i p = _mm512_loadu_si512(proto + i);
+            __m512i h = _mm512_mask_i32gather_epi32(zero, all, _mm512_and_si512(p, lowByte), table + 8 * 256, 4);
+            for (int k = 0; k < 4; ++k) {
+                __m512i sb = _mm512_and_si512(_mm512_maskz_srl_epi32(all, s, _mm_cvtsi32_si128(24 - 8 * k)), lowByte);
+                __m512i db = _mm512_and_si512(_mm512_maskz_srl_epi32(all, d, _mm_cvtsi32_si128(24 - 8 * k)), lowByte);
+                h = _mm512_xor_si512(h, _mm512_mask_i32gather_epi32(zero, all, sb, table + k * 256, 4));
+                h = _mm512_xor_si512(h, _mm512_mask_i32gather_epi32(zero, all, db, table + (4 + k) * 256, 4));
+            }
+            _mm512_storeu_si512(out + i, h);
+        }
+        return i;
+    }
+#endif
 
-// ------------------------- Route -------------------------
-// Klasa reprezentująca trasę w tablicy routingu
-class Route {
-    IPAddress network;
-    IPAddress gateway;
-    int metric;
 public:
-    Route(const IPAddress& net, const IPAddress& gw, int met)
-        : network(net), gateway(gw), metric(met) {}
+    // Domyślny klucz RSS z dokumentacji Microsoft
+    static constexpr uint8_t DEFAULT_KEY[40] = {
+        0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3,
+        0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3,
+        0x80, 0x30, 0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+    };
 
-    const IPAddress& getNetwork() const { return network; }
-    const IPAddress& getGateway() const { return gateway; }
-    int getMetric() const { return metric; }
+    explicit ToeplitzHash(const uint8_t* key = DEFAULT_KEY) {
+        // Okno 32 bitów klucza zaczynające się od bitu 'bit'
+        auto window = [&](int bit) {
+            uint64_t bytes = 0;
+            for (int i = 0; i < 5; ++i) bytes = (bytes << 8) | key[bit / 8 + i];
+            return static_cast<uint32_t>(bytes >> (8 - bit % 8));
+        };
+        for (int pos = 0; pos < INPUT_BYTES; ++pos) {
+            for (int value = 0; value < 256; ++value) {
+                uint32_t h = 0;
+                for (int b = 0; b < 8; ++b)
+                    if (value & (0x80 >> b)) h ^= window(pos * 8 + b);
+                table[pos * 256 + value] = h;
+            }
+        }
+    }
 
-    bool matches(const IPAddress& addr) const {
-        return network.matches(addr);
+    uint32_t hash(uint32_t src, uint32_t dst, uint8_t proto) const {
+        uint32_t h = table[8 * 256 + proto];
+        for (int k = 0; k < 4; ++k) {
+            h ^= table[k * 256 + ((src >> (24 - 8 * k)) & 0xFF)];
+            h ^= table[(4 + k) * 256 + ((dst >> (24 - 8 * k)) & 0xFF)];
+        }
+        return h;
     }
 
-    string toString() const {
-        ostringstream oss;
-        oss << "Sieć: " << network.toString()
-            << ", Brama: " << gateway.toString()
-            << ", Metryka: " << metric;
-        return oss.str();
+    // Hash dla n krotek naraz; wersje wektorowe dają wyniki identyczne ze skalarną
+    void hashBatch(const uint32_t* src, const uint32_t* dst, const uint32_t* proto, size_t n, uint32_t* out) const {
+        size_t done = 0;
+#if ROUTER_X86_SIMD
+        switch (activeSimdLevel().load(memory_order_relaxed)) {
+            case SimdLevel::Avx512: done = hashBatchAvx512(src, dst, proto, n, out); break;
+            case SimdLevel::Avx2: done = hashBatchAvx2(src, dst, proto, n, out); break;
+            default: break;
+        }
+#endif
+        for (size_t i = done; i < n; ++i)
+            out[i] = hash(src[i], dst[i], static_cast<uint8_t>(proto[i]));
     }
 };
 
-// ------------------------- RoutingTable -------------------------
-// Klasa reprezentująca tablicę routingu
-class RoutingTable {
-    vector<Route> routes;
-public:
-    void addRoute(const Route& r) {
-        routes.push_back(r);
-    }
+// ------------------------- ForwardingEngine -------------------------
+struct ForwardingStats {
+    uint64_t forwarded = 0;
+    uint64_t dropped = 0;
+    double seconds = 0;
+    vector<uint64_t> perWorker;   // liczba pakietów obsłużonych przez każdy wątek
+    vector<size_t> queuePeak;     // największa zajętość pierścienia każdego wątku
+    size_t queueCapacity = 0;
 
-    void removeRoute(const IPAddress& network) {
-        auto it = remove_if(routes.begin(), routes.end(),
-            [&](const Route& r) { return r.getNetwork() == network; });
+    double packetsPerSecond() const {
+        return seconds > 0 ? (forwarded + dropped) / seconds : 0.0;
+    }
 
-        if (it != routes.end()) {
-            routes.erase(it, routes.end());
-            cout << "Trasa została usunięta.\n";
-        } else {
-            cout << "Nie znaleziono podanej trasy.\n";
+    // Stosunek najbardziej obciążonego wątku do średniej (1.0 = idealnie równo)
+    double skew() const {
+        if (perWorker.empty()) return 0.0;
+        uint64_t total = 0, most = 0;
+        for (uint64_t n : perWorker) {
+            total += n;
+            most = max(most, n);
         }
+        return total ? static_cast<double>(most) * perWorker.size() / total : 0.0;
     }
+};
 
-    optional<Route> findRoute(const IPAddress& addr) const {
-        optional<Route> best;
-        for (const auto& r : routes) {
-            if (r.matches(addr)) {
-                if (!best || r.getNetwork().getPrefix() > best->getNetwork().getPrefix()) {
-                    best = r;
-                }
+// Wielowątkowe przekazywanie pakietów: każdy wątek roboczy ma własny pierścień SPSC, pobiera z niego
+// paczki uchwytów (indeksów pakietów) i rozwiązuje je wsadowo we wspólnej tablicy routingu.
+// Wątek wywołujący forward() rozdziela pakiety według hasha Toeplitza przepływu i tablicy
+// przekierowań (jak RSS), więc pakiety jednego przepływu trafiają do tego samego wątku
+// i zachowują kolejność. Ten sam hash wybiera trasę w grupach ECMP.
+class ForwardingEngine {
+public:
+    static constexpr size_t BURST = 64;
+    static constexpr size_t RETA_SIZE = 128;   // tablica przekierowań: hash -> wątek
+    static constexpr size_t HASH_CHUNK = 1024; // pakiety haszowane jednym wywołaniem wsadowym
+    static constexpr size_t RING_SIZE = 4096;
+
+private:
+    struct alignas(64) Worker {
+        SpscRing<uint32_t> ring{RING_SIZE};
+        uint64_t forwarded = 0;
+        uint64_t dropped = 0;
+        thread runner;
+    };
+
+    const RoutingTable& table;
+    vector<unique_ptr<Worker>> workers;
+    ToeplitzHash rss;
+    uint32_t reta[RETA_SIZE];
+    const vector<Packet>* packets = nullptr;
+    vector<uint32_t> flowHashes;    // hash przepływu każdego pakietu, liczony przy rozdzielaniu
+    atomic<uint64_t> completed{0};
+    atomic<bool> stopping{false};
+
+    // Rdzeń 0 zostaje dla wątku rozdzielającego, o ile rdzeni jest więcej niż wątków
+    static void pinToCore(size_t worker) {
+#ifdef __linux__
+        size_t cores = max(1u, thread::hardware_concurrency());
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((worker + 1) % cores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+        (void)worker;
+#endif
+    }
+
+    void run(Worker& w, size_t index) {
+        pinToCore(index);
+        uint32_t handles[BURST], dsts[BURST], hashes[BURST], slots[BURST];
+        unsigned spins = 0;
+        while (true) {
+            size_t n = w.ring.dequeueBurst(handles, BURST);
+            if (n == 0) {
+                if (stopping.load(memory_order_acquire)) return;
+                cpuRelax(spins);
+                continue;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                dsts[i] = (*packets)[handles[i]].getDestination().getAddr();
+                hashes[i] = flowHashes[handles[i]];
             }
+            table.findRoutes(dsts, hashes, n, slots);
+            for (size_t i = 0; i < n; ++i) {
+                if (slots[i] != NO_ROUTE) ++w.forwarded;
+                else ++w.dropped;
+            }
+            completed.fetch_add(n, memory_order_release);
         }
-        return best;
     }
 
-    void print() const {
-        if (routes.empty()) {
-            cout << "Tablica routingu jest pusta.\n";
-            return;
+    // Pełny pierścień oznacza, że wątek nie nadąża - rozdzielający czeka zamiast gubić pakiety
+    void enqueue(size_t worker, const uint32_t* handles, size_t n) {
+        SpscRing<uint32_t>& ring = workers[worker]->ring;
+        unsigned spins = 0;
+        for (size_t done = 0; done < n; ) {
+            done += ring.enqueueBurst(handles + done, n - done);
+            if (done < n) cpuRelax(spins);
         }
+    }
 
-        vector<Route> sorted = routes;
-        sort(sorted.begin(), sorted.end(), [](const Route& a, const Route& b) {
-            return a.getMetric() < b.getMetric();
-        });
+public:
+    ForwardingEngine(const RoutingTable& t, size_t workerCount) : table(t) {
+        if (workerCount == 0)
+            throw invalid_argument("Liczba wątków musi być większa od zera.");
+        for (size_t i = 0; i < workerCount; ++i)
+            workers.push_back(make_unique<Worker>());
+        for (size_t i = 0; i < RETA_SIZE; ++i)
+            reta[i] = static_cast<uint32_t>(i % workerCount);
+        for (size_t i = 0; i < workerCount; ++i)
+            workers[i]->runner = thread([this, i] { run(*workers[i], i); });
+    }
 
-        cout << "Aktualna tablica routingu:\n";
-        for (const auto& r : sorted)
-            cout << "  " << r.toString() << endl;
+    ~ForwardingEngine() {
+        stopping = true;
+        for (auto& w : workers)
+            w->runner.join();
     }
-};
 
-// ------------------------- Packet -------------------------
-// Klasa reprezentująca pakiet
-class Packet {
-    IPAddress source;
-    IPAddress destination;
-    string protocol;
-public:
-    Packet(const IPAddress& src, const IPAddress& dst, const string& proto)
-        : source(src), destination(dst), protocol(proto) {}
+    ForwardingEngine(const ForwardingEngine&) = delete;
+    ForwardingEngine& operator=(const ForwardingEngine&) = delete;
 
-    const IPAddress& getDestination() const { return destination; }
+    // Przekazuje wszystkie pakiety i czeka na zakończenie
+    ForwardingStats forward(const vector<Packet>& batch) {
+        packets = &batch;
+        flowHashes.resize(batch.size());
+        completed = 0;
+        for (auto& w : workers) w->forwarded = w->dropped = 0;
 
-    string toString() const {
-        ostringstream oss;
-        oss << "Pakiet od " << source.toString()
-            << " do " << destination.toString()
-            << " [" << protocol << "]";
-        return oss.str();
+        auto start = chrono::steady_clock::now();
+        vector<uint32_t> pending(workers.size() * BURST);
+        vector<size_t> pendingCount(workers.size(), 0);
+        uint32_t src[HASH_CHUNK], dst[HASH_CHUNK], proto[HASH_CHUNK];
+        for (size_t first = 0; first < batch.size(); first += HASH_CHUNK) {
+            size_t n = min(HASH_CHUNK, batch.size() - first);
+            for (size_t i = 0; i < n; ++i) {
+                const Packet& p = batch[first + i];
+                src[i] = p.getSource().getAddr();
+                dst[i] = p.getDestination().getAddr();
+                proto[i] = p.getProtocolNumber();
+            }
+            uint32_t* hashes = &flowHashes[first];
+            rss.hashBatch(src, dst, proto, n, hashes);
+            for (size_t i = 0; i < n; ++i) {
+                size_t w = reta[hashes[i] % RETA_SIZE];
+                pending[w * BURST + pendingCount[w]++] = static_cast<uint32_t>(first + i);
+                if (pendingCount[w] == BURST) {
+                    enqueue(w, &pending[w * BURST], BURST);
+                    pendingCount[w] = 0;
+                }
+            }
+        }
+        for (size_t w = 0; w < workers.size(); ++w)
+            if (pendingCount[w]) enqueue(w, &pending[w * BURST], pendingCount[w]);
+
+        while (completed.load(memory_order_acquire) < batch.size())
+            this_thread::yield();
+
+        ForwardingStats stats;
+        stats.seconds = secondsSince(start);
+        for (auto& w : workers) {
+            stats.forwarded += w->forwarded;
+            stats.dropped += w->dropped;
+            stats.perWorker.push_back(w->forwarded + w->dropped);
+            stats.queuePeak.push_back(w->ring.highWater());
+        }
+        stats.queueCapacity = RING_SIZE;
+        packets = nullptr;
+        return stats;
     }
+
+    size_t workerCount() const { return workers.size(); }
 };
 
 // ------------------------- RouterCLI -------------------------
 // Klasa odpowiedzialna za interfejs wiersza poleceń (CLI) dla symulatora routera
 class RouterCLI {
     RoutingTable table;
+    ToeplitzHash flowHash;
     ofstream log;
+    RouteJournal journal;
+    bool openedSnapshot = false;    // dziennik zależy od pliku migawki do następnego punktu kontrolnego
 public:
-    RouterCLI() : log("router.log", ios::app) {}
+    RouterCLI() : log("router.log", ios::app), journal("router.journal", "router.checkpoint") {}
+
+    // Do dziennika trafia tylko ścieżka migawki - punkt kontrolny powstaje przy pierwszej zmianie,
+    // która i tak wczytuje całą migawkę, więc otwarcie nie zależy od rozmiaru tablicy
+    void openSnapshot(const string& path) {
+        auto start = chrono::steady_clock::now();
+        JournalRecord record{JournalRecord::Op::Open};
+        record.path = filesystem::absolute(path).string();
+        journal.append(record);
+        table.open(path);
+        openedSnapshot = true;
+        cout << "Otwarto migawkę FIB " << path << " (" << table.size() << " tras) w " << secondsSince(start) * 1000
+             << " ms - wyszukiwania korzystają wprost z pliku\n";
+        log << "OPEN " << path << "\n";
+    }
+
+    // Odtwarza stan z ostatniego uruchomienia: najnowszy punkt kontrolny i zmiany z dziennika po nim
+    void recover() {
+        RecoveryStats stats = journal.recover(table);
+        if (!stats.checkpoint.empty())
+            cout << "Wczytano punkt kontrolny " << stats.checkpoint << " (zmiany do " << stats.checkpointSequence
+                 << ") w " << stats.loadSeconds * 1000 << " ms\n";
+        if (stats.replayed > 0) {
+            cout << "Powtórzono " << stats.replayed << " zmian z dziennika w " << stats.replaySeconds * 1000 << " ms";
+            if (stats.failed > 0)
+                cout << " (" << stats.failed << " zakończonych błędem, jak przy pierwszym wykonaniu)";
+            cout << "\n";
+        }
+        if (stats.droppedBytes > 0)
+            cout << "Pominięto " << stats.droppedBytes << " B niekompletnego lub uszkodzonego końca dziennika\n";
+        if (stats.missingChanges)
+            cout << "Uwaga: brak punktu kontrolnego dla zmian sprzed początku dziennika - stan może być niepełny\n";
+        openedSnapshot = !stats.snapshot.empty();
+        if (!stats.checkpoint.empty() || stats.replayed > 0) {
+            cout << "Odtworzono stan tablicy: " << stats.routes << " tras\n";
+            log << "RECOVER " << stats.checkpoint << " + " << stats.replayed << " zmian (" << stats.routes << " tras)\n";
+        }
+    }
 
     void run() {
         string cmd;
@@ -190,7 +4831,22 @@ public:
                 if (op == "add") handleAdd(ss);
                 else if (op == "del") handleDelete(ss);
                 else if (op == "show") table.print();
+                else if (op == "load") handleLoad(ss);
+                else if (op == "mrt") handleMrt(ss);
+                else if (op == "save") handleSave(ss);
+                else if (op == "open") handleOpen(ss);
+                else if (op == "checkpoint") checkpoint();
+                else if (op == "gwmove") handleGatewayMove(ss);
+                else if (op == "gwdown") handleGatewayState(ss, false);
+                else if (op == "gwup") handleGatewayState(ss, true);
+                else if (op == "gw") handleGateway(ss);
                 else if (op == "send") handleSend(ss);
+                else if (op == "engine") handleEngine(ss);
+                else if (op == "stats") table.printStats();
+                else if (op == "bench") handleBench(ss);
+                else if (op == "simd") handleSimd(ss);
+                else if (op == "cache") handleCache(ss);
+                else if (op == "flood") handleFlood(ss);
                 else if (op == "help") printHelp();
                 else if (op == "exit") break;
                 else cout << "Nieznane polecenie. Wpisz 'help' aby zobaczyć dostępne komendy.\n";
@@ -205,13 +4861,125 @@ private:
         cout << "=== Symulator Routera IP ===\n";
         cout << "Dostępne polecenia:\n";
         cout << "  add <sieć> <brama> <metryka>  - dodaje trasę (np. add 192.168.1.0/24 192.168.1.1 10)\n";
-        cout << "  del <sieć>                    - usuwa trasę (np. del 192.168.1.0/24)\n";
+        cout << "  del <sieć> [brama]            - usuwa trasy do sieci lub tylko tę przez bramę\n";
         cout << "  show                          - pokazuje tablicę routingu\n";
+        cout << "  save|open <plik>              - zapisuje/otwiera (mmap) binarną migawkę FIB\n";
+        cout << "  checkpoint                    - zapisuje punkt kontrolny i zaczyna nowy dziennik zmian\n";
+        cout << "  load <plik> [wątki]           - wczytuje trasy z pliku (wiersze: <sieć> <brama> <metryka>)\n";
+        cout << "  mrt <plik> [ścieżki]          - importuje zrzut BGP MRT TABLE_DUMP_V2 (ścieżki na prefiks, 0 - wszystkie)\n";
+        cout << "  gwmove <brama> <nowa>         - przenosi wszystkie trasy przez bramę na nowy adres\n";
+        cout << "  gwdown|gwup <brama>           - zgłasza awarię/powrót bramy (trasy przechodzą na zapasowe)\n";
+        cout << "  gw <brama>                    - pokazuje trasy przez bramę\n";
         cout << "  send <źródło> <cel> <prot>    - wysyła pakiet (np. send 10.0.0.1 192.168.1.100 ICMP)\n";
+        cout << "  flood <pakiety> [wątki]       - przekazuje losowy ruch wielowątkowo i podaje pakiety/s\n";
+        cout << "  engine [nazwa]                - pokazuje/zmienia silnik wyszukiwania (np. engine poptrie)\n";
+        cout << "  stats                         - pokazuje statystyki i zużycie pamięci\n";
+        cout << "  bench lookup [liczba]         - mierzy wydajność wyszukiwania pojedynczego i wsadowego\n";
+        cout << "  bench rcu [czyt.] [aktual.]   - mierzy wyszukiwania współbieżne ze zmianami tras\n";
+        cout << "  bench ring [operacje]         - mierzy przepustowość pierścieni SPSC i MPSC\n";
+        cout << "  bench fib [trasy]             - buduje duży FIB i porównuje układy pamięci tras\n";
+        cout << "  bench parse [adresy]          - mierzy szybkość parsera adresów IPv4\n";
+        cout << "  simd [scalar|avx2|avx512]     - pokazuje/ogranicza wektorowe wyszukiwanie wsadowe\n";
+        cout << "  cache <wpisy>                 - zmienia rozmiar pamięci podręcznej wyszukiwań (0 wyłącza)\n";
         cout << "  help                          - pokazuje tę pomoc\n";
         cout << "  exit                          - kończy program\n";
     }
 
+    // Punkt kontrolny obejmuje też zmiany spoza dziennika (load, mrt)
+    void checkpoint() {
+        auto start = chrono::steady_clock::now();
+        string path = journal.checkpoint(table);
+        cout << "Zapisano punkt kontrolny " << path << " (" << table.size() << " tras) w "
+             << secondsSince(start) * 1000 << " ms\n";
+        log << "CHECKPOINT " << path << "\n";
+        openedSnapshot = false;
+    }
+
+    // Zmiana trafia do dziennika przed wykonaniem; po wykonaniu co CHECKPOINT_RECORDS zmian
+    // i po pierwszej zmianie otwartej migawki zapisywany jest punkt kontrolny
+    template <class Change>
+    auto journaled(const JournalRecord& record, Change change) {
+        journal.append(record);
+        auto result = change();
+        if (journal.checkpointDue() || openedSnapshot)
+            checkpoint();
+        return result;
+    }
+
+    void handleSave(istringstream& ss) {
+        string path;
+        if (!(ss >> path)) {
+            cout << "Użycie: save <plik>\n";
+            return;
+        }
+        auto start = chrono::steady_clock::now();
+        table.save(path);
+        cout << "Zapisano migawkę FIB (" << table.size() << " tras) w " << secondsSince(start) * 1000 << " ms\n";
+        log << "SAVE " << path << "\n";
+    }
+
+    void handleOpen(istringstream& ss) {
+        string path;
+        if (!(ss >> path)) {
+            cout << "Użycie: open <plik>\n";
+            return;
+        }
+        openSnapshot(path);
+    }
+
+    void handleLoad(istringstream& ss) {
+        string path;
+        size_t threads = max(1u, thread::hardware_concurrency());
+        if (!(ss >> path)) {
+            cout << "Użycie: load <plik> [wątki]  (wiersze: <sieć> <brama> <metryka>)\n";
+            return;
+        }
+        readOptional(ss, threads);
+
+        RouteFileStats stats = loadRouteFile(path, table, threads);
+        cout << "Wczytano " << stats.routes << " tras z " << stats.lines << " wierszy ("
+             << stats.bytes / 1048576.0 << " MB) w " << (stats.parseSeconds + stats.buildSeconds) * 1000
+             << " ms: parsowanie " << stats.parseSeconds * 1000 << " ms (" << stats.threads << " wątków), budowa "
+             << stats.buildSeconds * 1000 << " ms\n";
+        if (stats.errors > 0)
+            cout << "Pominięto " << stats.errors << " błędnych wierszy, pierwszy: wiersz " << stats.firstErrorLine
+                 << " (" << parseErrorMessage(stats.firstError) << ")\n";
+        if (stats.skipped > 0)
+            cout << "Pominięto " << stats.skipped << " tras ponad limit tras do jednej sieci\n";
+        log << "LOAD " << path << " (" << stats.routes << " tras)\n";
+        checkpoint();
+    }
+
+    void handleMrt(istringstream& ss) {
+        string path;
+        size_t maxPaths = 4;
+        if (!(ss >> path)) {
+            cout << "Użycie: mrt <plik> [ścieżki na prefiks]  (rozpakowany zrzut TABLE_DUMP_V2, np. rib.*)\n";
+            return;
+        }
+        readOptional(ss, maxPaths);
+
+        MrtImportStats stats = importMrtFile(path, table, maxPaths);
+        double megabytes = stats.bytes / 1048576.0;
+        cout << "Zaimportowano " << stats.routes << " tras dla " << stats.prefixes << " prefiksów z " << stats.entries
+             << " wpisów RIB (" << stats.records << " rekordów, " << megabytes << " MB)\n";
+        cout << "Parsowanie " << stats.parseSeconds * 1000 << " ms (" << megabytes / max(stats.parseSeconds, 1e-9)
+             << " MB/s), budowa " << stats.buildSeconds * 1000 << " ms w " << stats.batches << " paczkach (do "
+             << stats.peakBatch << " tras)\n";
+        if (stats.otherRecords > 0)
+            cout << "Pominięto " << stats.otherRecords << " rekordów innych typów (np. IPv6)\n";
+        if (stats.noNextHop > 0)
+            cout << "Pominięto " << stats.noNextHop << " wpisów bez następnego skoku IPv4\n";
+        if (stats.malformed > 0)
+            cout << "Pominięto " << stats.malformed << " uszkodzonych rekordów\n";
+        if (stats.truncated)
+            cout << "Plik urywa się w połowie rekordu - wczytano trasy do tego miejsca\n";
+        if (stats.skipped > 0)
+            cout << "Pominięto " << stats.skipped << " tras ponad limit tras do jednej sieci\n";
+        log << "MRT " << path << " (" << stats.routes << " tras)\n";
+        checkpoint();
+    }
+
     void handleAdd(istringstream& ss) {
         string net, gw;
         int m;
@@ -220,20 +4988,452 @@ private:
             return;
         }
 
-        table.addRoute(Route(IPAddress(net), IPAddress(gw), m));
+        Route route(IPAddress(net), IPAddress(gw), m);
+        const IPAddress& network = route.getNetwork();
+        journaled({JournalRecord::Op::Add, network.getAddr(), static_cast<uint8_t>(network.getPrefix()),
+                   route.getGateway().getAddr(), m},
+                  [&] { table.addRoute(route); return true; });
         cout << "Dodano trasę.\n";
         log << "ADD " << net << " przez " << gw << " metryka " << m << "\n";
     }
 
     void handleDelete(istringstream& ss) {
-        string net;
+        string net, gw;
         if (!(ss >> net)) {
-            cout << "Użycie: del <sieć>\n";
+            cout << "Użycie: del <sieć> [brama]\n";
+            return;
+        }
+
+        IPAddress network(net);
+        uint8_t prefix = static_cast<uint8_t>(network.getPrefix());
+        bool removed;
+        if (ss >> gw) {
+            IPAddress gateway(gw);
+            removed = journaled({JournalRecord::Op::RemoveVia, network.getAddr(), prefix, gateway.getAddr()},
+                                [&] { return table.removeRoute(network, gateway); });
+        } else {
+            removed = journaled({JournalRecord::Op::Remove, network.getAddr(), prefix},
+                                [&] { return table.removeRoute(network); });
+        }
+        if (removed)
+            cout << "Trasa została usunięta.\n";
+        else
+            cout << "Nie znaleziono podanej trasy.\n";
+        log << "DEL " << net;
+        if (!gw.empty()) log << " przez " << gw;
+        log << "\n";
+    }
+
+    void handleGatewayMove(istringstream& ss) {
+        string from, to;
+        if (!(ss >> from >> to)) {
+            cout << "Użycie: gwmove <brama> <nowa brama>\n";
+            return;
+        }
+
+        IPAddress oldGateway(from), newGateway(to);
+        if (journaled({JournalRecord::Op::GatewayMove, oldGateway.getAddr(), 32, newGateway.getAddr()},
+                      [&] { return table.repointGateway(oldGateway, newGateway); }))
+            cout << "Trasy przez " << from << " prowadzą teraz przez " << to << ".\n";
+        else
+            cout << "Żadna trasa nie prowadzi przez podaną bramę.\n";
+        log << "GWMOVE " << from << " -> " << to << "\n";
+    }
+
+    void handleGatewayState(istringstream& ss, bool up) {
+        string gw;
+        if (!(ss >> gw)) {
+            cout << "Użycie: " << (up ? "gwup" : "gwdown") << " <brama>\n";
+            return;
+        }
+
+        IPAddress gateway(gw);
+        JournalRecord record{up ? JournalRecord::Op::GatewayUp : JournalRecord::Op::GatewayDown, 0, 0, gateway.getAddr()};
+        auto start = chrono::steady_clock::now();
+        double elapsed = 0;
+        size_t routes = journaled(record, [&] {
+            size_t changed = table.setGatewayUp(gateway, up);
+            elapsed = secondsSince(start);
+            return changed;
+        });
+        if (routes == 0) {
+            cout << "Zapisano stan bramy " << gw << "; obecnie żadna trasa nie prowadzi przez nią bezpośrednio.\n";
+        } else {
+            cout << "Brama " << gw << (up ? " działa" : " nie działa") << ": " << routes << " tras "
+                 << (up ? "wraca na nią" : "przechodzi na pozostałe ścieżki lub trasy zapasowe")
+                 << " (" << elapsed * 1e6 << " us)\n";
+        }
+        log << (up ? "GWUP " : "GWDOWN ") << gw << "\n";
+    }
+
+    void handleGateway(istringstream& ss) {
+        string gw;
+        if (!(ss >> gw)) {
+            cout << "Użycie: gw <brama>\n";
+            return;
+        }
+
+        vector<Route> via = table.routesVia(IPAddress(gw));
+        if (via.empty()) {
+            cout << "Żadna trasa nie prowadzi przez podaną bramę.\n";
+            return;
+        }
+        cout << "Trasy przez " << gw << ": " << via.size() << "\n";
+        const size_t shown = 20;
+        for (size_t i = 0; i < via.size() && i < shown; ++i)
+            cout << "  " << via[i].toString() << "\n";
+        if (via.size() > shown)
+            cout << "  ... i " << via.size() - shown << " innych\n";
+    }
+
+    void handleEngine(istringstream& ss) {
+        string name;
+        if (!(ss >> name)) {
+            cout << "Bieżący silnik: " << table.engineName() << ". Dostępne:";
+            for (const auto& n : lpmEngineNames()) cout << ' ' << n;
+            cout << "\n";
+            return;
+        }
+
+        table.setEngine(name);
+        cout << "Przebudowano tablicę w silniku " << table.engineName() << ".\n";
+    }
+
+    void handleBench(istringstream& ss) {
+        string what;
+        ss >> what;
+        if (what == "lookup") benchLookup(ss);
+        else if (what == "rcu") benchConcurrent(ss);
+        else if (what == "ring") benchRing(ss);
+        else if (what == "fib") benchFib(ss);
+        else if (what == "parse") benchParse(ss);
+        else cout << "Użycie: bench lookup [liczba] | bench rcu [czytelnicy] [aktualizacje] | bench ring [operacje]"
+                     " | bench fib [trasy] | bench parse [adresy]\n";
+    }
+
+    void benchLookup(istringstream& ss) {
+        size_t count = 1000000;
+        readOptional(ss, count);
+        if (count == 0) {
+            cout << "Użycie: bench lookup [liczba]\n";
+            return;
+        }
+
+        vector<uint32_t> dsts(count), slots(count);
+        mt19937 rng(12345);
+        for (auto& d : dsts) d = rng();
+
+        auto start = chrono::steady_clock::now();
+        uint32_t checksum = 0;
+        for (uint32_t d : dsts) checksum ^= table.findSlot(d);
+        double single = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        table.findRoutes(dsts.data(), nullptr, count, slots.data());
+        double batch = secondsSince(start);
+
+        start = chrono::steady_clock::now();
+        for (uint32_t d : dsts) checksum ^= table.findSlotCached(d);
+        double cached = secondsSince(start);
+
+        for (uint32_t s : slots) checksum ^= s;
+        cout << "Silnik " << table.engineName() << " (SIMD: " << simdLevelName(activeSimdLevel()) << "), " << count << " adresów (suma kontrolna " << checksum << ")\n";
+        cout << "  pojedynczo: " << count / single / 1e6 << " mln wyszukiwań/s\n";
+        cout << "  wsadowo:    " << count / batch / 1e6 << " mln wyszukiwań/s\n";
+        cout << "  przez pamięć podręczną: " << count / cached / 1e6 << " mln wyszukiwań/s\n";
+    }
+
+    // Wątki czytelników wyszukują wsadowo, a wątek CLI w tym czasie dodaje i usuwa trasy
+    // z zakresu testowego 198.18.0.0/15, którego nie ma jeszcze w tablicy
+    void benchConcurrent(istringstream& ss) {
+        size_t readers = 2, updates = 10000;
+        readOptional(ss, readers);
+        readOptional(ss, updates);
+        if (readers == 0 || updates == 0) {
+            cout << "Użycie: bench rcu [czytelnicy] [aktualizacje]\n";
+            return;
+        }
+
+        vector<IPAddress> prefixes;
+        for (uint32_t i = 0; i < 512; ++i) {
+            IPAddress net(0xC6120000u + (i << 8), 24);
+            if (!table.hasRoute(net)) prefixes.push_back(net);
+        }
+        if (prefixes.empty()) {
+            cout << "Zakres 198.18.0.0/15 jest zajęty - brak prefiksów do testu.\n";
+            return;
+        }
+
+        atomic<bool> stop{false};
+        atomic<uint64_t> lookups{0};
+        vector<thread> threads;
+        for (size_t r = 0; r < readers; ++r) {
+            threads.emplace_back([&, r] {
+                mt19937 rng(static_cast<uint32_t>(r + 1));
+                vector<uint32_t> dsts(256), slots(256);
+                uint64_t done = 0;
+                while (!stop.load(memory_order_relaxed)) {
+                    for (auto& d : dsts) d = 0xC6120000u | (rng() & 0x1FFFF);
+                    table.findRoutes(dsts.data(), nullptr, dsts.size(), slots.data());
+                    done += dsts.size();
+                }
+                lookups += done;
+            });
+        }
+
+        Route template_(IPAddress("0.0.0.0/0"), IPAddress("198.18.255.1"), 1);
+        double maxUpdate = 0;
+        auto start = chrono::steady_clock::now();
+        for (size_t i = 0; i < updates; ++i) {
+            const IPAddress& net = prefixes[(i / 2) % prefixes.size()];
+            auto t = chrono::steady_clock::now();
+            if (i % 2 == 0) table.addRoute(Route(net, template_.getGateway(), 1));
+            else table.removeRoute(net);
+            maxUpdate = max(maxUpdate, secondsSince(t));
+        }
+        if (updates % 2) table.removeRoute(prefixes[(updates / 2) % prefixes.size()]);
+        double elapsed = secondsSince(start);
+
+        stop = true;
+        for (auto& t : threads) t.join();
+
+        cout << "Czytelnicy: " << readers << ", " << lookups / elapsed / 1e6 << " mln wyszukiwań/s łącznie\n";
+        cout << "Aktualizacje: " << updates << ", średnio " << elapsed / updates * 1e6
+             << " us, najdłużej " << maxUpdate * 1e6 << " us\n";
+    }
+
+    // Para producent-konsument przerzuca liczby paczkami po 32 przez SpscRing, a następnie
+    // dwóch producentów przez MpscRing; wynik to przeniesione elementy na sekundę
+    void benchRing(istringstream& ss) {
+        size_t ops = 50000000;
+        readOptional(ss, ops);
+        if (ops == 0) {
+            cout << "Użycie: bench ring [operacje]\n";
+            return;
+        }
+
+        static constexpr size_t RING_BURST = 32;
+        auto consume = [ops](auto& ring) {
+            uint64_t items[RING_BURST], sum = 0;
+            unsigned spins = 0;
+            for (size_t got = 0; got < ops; ) {
+                size_t n = ring.dequeueBurst(items, RING_BURST);
+                if (n == 0) { cpuRelax(spins); continue; }
+                for (size_t i = 0; i < n; ++i) sum += items[i];
+                got += n;
+            }
+            return sum;
+        };
+        auto produce = [](auto& ring, size_t from, size_t to) {
+            uint64_t items[RING_BURST];
+            unsigned spins = 0;
+            for (size_t next = from; next < to; ) {
+                size_t n = min(RING_BURST, to - next);
+                for (size_t i = 0; i < n; ++i) items[i] = next + i;
+                size_t done = 0;
+                while (done < n) {
+                    size_t pushed = ring.enqueueBurst(items + done, n - done);
+                    if (pushed == 0) cpuRelax(spins);
+                    done += pushed;
+                }
+                next += n;
+            }
+        };
+        uint64_t expected = static_cast<uint64_t>(ops) * (ops - 1) / 2;
+
+        {
+            SpscRing<uint64_t> ring(4096);
+            auto start = chrono::steady_clock::now();
+            thread producer([&] { produce(ring, 0, ops); });
+            uint64_t sum = consume(ring);
+            producer.join();
+            double elapsed = secondsSince(start);
+            cout << "SPSC: " << ops / elapsed / 1e6 << " mln operacji/s"
+                 << (sum == expected ? "" : " (BŁĄD: niezgodna suma)") << "\n";
+        }
+        {
+            MpscRing<uint64_t> ring(4096);
+            auto start = chrono::steady_clock::now();
+            thread first([&] { produce(ring, 0, ops / 2); });
+            thread second([&] { produce(ring, ops / 2, ops); });
+            uint64_t sum = consume(ring);
+            first.join();
+            second.join();
+            double elapsed = secondsSince(start);
+            cout << "MPSC (2 producentów): " << ops / elapsed / 1e6 << " mln operacji/s"
+                 << (sum == expected ? "" : " (BŁĄD: niezgodna suma)") << "\n";
+        }
+    }
+
+    // Tablica 'count' tras /24 przez cztery bramy: czas budowy, pamięć i wyszukiwania wsadowe,
+    // a potem sam odczyt skoku trasy (jak w ścieżce pakietu) dla losowych slotów w trzech
+    // układach pamięci - im mniejszy zbiór roboczy, tym mniej chybień pamięci podręcznej
+    void benchFib(istringstream& ss) {
+        size_t count = 1000000;
+        readOptional(ss, count);
+        if (count == 0 || count > (1u << 24)) {
+            cout << "Użycie: bench fib [trasy] (najwyżej 16777216)\n";
+            return;
+        }
+
+        RoutingTable fib;
+        fib.setEngine("dir24");
+        auto start = chrono::steady_clock::now();
+        for (uint32_t i = 0; i < count; ++i)
+            fib.addRoute(Route(IPAddress(i << 8, 24), IPAddress(0x0A000001u + (i & 3), 32), 1));
+        double build = secondsSince(start);
+        cout << "Tablica " << count << " tras: budowa " << build << " s, pamięć (dwie kopie) "
+             << fib.memoryUsage() / (1024 * 1024) << " MB, " << fib.memoryUsage() / 2 / count
+             << " B na trasę w jednej kopii (w tym kolumny FIB " << RouteColumns::BYTES_PER_ROUTE << " B)\n";
+
+        const size_t lookups = 4000000;
+        vector<uint32_t> dsts(lookups), hashes(lookups), slots(lookups);
+        mt19937 rng(99);
+        for (size_t i = 0; i < lookups; ++i) {
+            dsts[i] = (static_cast<uint32_t>(rng() % count) << 8) | (rng() & 0xFF);
+            hashes[i] = rng();
+        }
+        start = chrono::steady_clock::now();
+        fib.findRoutes(dsts.data(), hashes.data(), lookups, slots.data());
+        cout << "  wyszukiwania wsadowe: " << lookups / secondsSince(start) / 1e6 << " mln/s\n";
+
+        // Ten sam odczyt skoku przy trzech układach: kolumna, struktura trasy, optional<Route>
+        struct PackedRoute {
+            uint32_t network;
+            uint32_t nextHop;
+            int32_t metric;
+            uint8_t prefix;
+        };
+        vector<uint32_t> column(count);
+        vector<PackedRoute> packed(count);
+        vector<optional<Route>> objects;
+        objects.reserve(count);
+        for (uint32_t i = 0; i < count; ++i) {
+            column[i] = i & 3;
+            packed[i] = {i << 8, i & 3, 1, 24};
+            objects.emplace_back(Route(IPAddress(i << 8, 24), IPAddress(0x0A000001u + (i & 3), 32), 1));
+        }
+        for (auto& s : slots) s = rng() % count;
+
+        auto measure = [&](const char* name, size_t bytes, auto&& read) {
+            uint64_t sum = 0;
+            auto t = chrono::steady_clock::now();
+            for (uint32_t s : slots) sum += read(s);
+            double elapsed = secondsSince(t);
+            cout << "  " << name << " (" << bytes << " B na trasę): " << elapsed / lookups * 1e9
+                 << " ns na odczyt, zbiór roboczy " << count * bytes / 1048576.0 << " MB (suma " << sum << ")\n";
+        };
+        measure("kolumna nextHop", sizeof(uint32_t), [&](uint32_t s) { return column[s]; });
+        measure("struktura trasy", sizeof(PackedRoute), [&](uint32_t s) { return packed[s].nextHop; });
+        measure("optional<Route>", sizeof(optional<Route>),
+                [&](uint32_t s) { return objects[s]->getGateway().getAddr() - 0x0A000001u; });
+    }
+
+    void benchParse(istringstream& ss) {
+        size_t count = 4000000;
+        readOptional(ss, count);
+        if (count == 0 || count > (1u << 26)) {
+            cout << "Użycie: bench parse [adresy] (najwyżej 67108864)\n";
+            return;
+        }
+
+        // Adresy w jednym buforze, rozdzielone znakiem nowej linii - jak w pliku z trasami
+        string buffer;
+        buffer.reserve(count * 16);
+        vector<string_view> texts;
+        texts.reserve(count);
+        mt19937 rng(7);
+        for (size_t i = 0; i < count; ++i)
+            buffer += IPAddress(static_cast<uint32_t>(rng()), 32).toString() + '\n';
+        for (size_t pos = 0; pos < buffer.size();) {
+            size_t end = buffer.find('\n', pos);
+            size_t slash = buffer.find('/', pos);
+            texts.emplace_back(buffer.data() + pos, (slash < end ? slash : end) - pos);
+            pos = end + 1;
+        }
+
+        uint64_t sum = 0;
+        size_t errors = 0;
+        auto start = chrono::steady_clock::now();
+        for (string_view text : texts) {
+            uint32_t addr = 0;
+            if (parseIPv4(text, addr, buffer.data() + buffer.size()) != ParseError::None) ++errors;
+            sum += addr;
+        }
+        double elapsed = secondsSince(start);
+        cout << "parseIPv4: " << count / elapsed / 1e6 << " mln adresów/s, "
+             << buffer.size() / elapsed / (1024 * 1024) << " MB/s (błędy " << errors << ", suma " << sum << ")\n";
+
+        // Punkt odniesienia: dawny parser oparty na sscanf, na próbce
+        size_t sample = min<size_t>(count, 1000000);
+        sum = 0;
+        start = chrono::steady_clock::now();
+        for (size_t i = 0; i < sample; ++i) {
+            string ip(texts[i]);
+            int parts[4];
+            if (sscanf(ip.c_str(), "%d.%d.%d.%d", &parts[0], &parts[1], &parts[2], &parts[3]) == 4)
+                sum += (static_cast<uint32_t>(parts[0]) << 24) | (parts[1] << 16) | (parts[2] << 8) | parts[3];
+        }
+        cout << "sscanf:    " << sample / secondsSince(start) / 1e6 << " mln adresów/s (suma " << sum << ")\n";
+    }
+
+    void handleSimd(istringstream& ss) {
+        string level;
+        if (ss >> level)
+            setSimdLevel(level);
+        cout << "Poziom SIMD: " << simdLevelName(activeSimdLevel()) << " (procesor obsługuje: "
+             << simdLevelName(detectSimdLevel()) << ")\n";
+    }
+
+    void handleCache(istringstream& ss) {
+        size_t entries;
+        if (!(ss >> entries)) {
+            cout << "Użycie: cache <wpisy>\n";
+            return;
+        }
+
+        table.resizeCache(entries);
+        cout << "Zmieniono rozmiar pamięci podręcznej wyszukiwań.\n";
+    }
+
+    // Losowy ruch: cele wybierane z prefiksów tablicy (z losową częścią hosta), gdy tablica nie jest pusta
+    static vector<Packet> generateTraffic(const vector<IPAddress>& nets, size_t count, uint32_t seed) {
+        static const string protocols[] = {"TCP", "UDP", "ICMP"};
+        mt19937 rng(seed);
+        vector<Packet> packets;
+        packets.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            uint32_t dst = rng();
+            if (!nets.empty()) {
+                const IPAddress& net = nets[rng() % nets.size()];
+                dst = net.getAddr() | (dst & ~prefixMask(net.getPrefix()));
+            }
+            packets.emplace_back(IPAddress(rng(), 32), IPAddress(dst, 32), protocols[rng() % 3]);
+        }
+        return packets;
+    }
+
+    void handleFlood(istringstream& ss) {
+        size_t count, workers = max(1u, thread::hardware_concurrency());
+        if (!(ss >> count) || count == 0) {
+            cout << "Użycie: flood <pakiety> [wątki]\n";
             return;
         }
+        readOptional(ss, workers);
 
-        table.removeRoute(IPAddress(net));
-        log << "DEL " << net << "\n";
+        vector<Packet> packets = generateTraffic(table.networks(), count, 2024);
+        ForwardingEngine engine(table, workers);
+        ForwardingStats stats = engine.forward(packets);
+
+        cout << "Przekazano " << stats.forwarded << ", odrzucono " << stats.dropped << " pakietów w "
+             << stats.seconds * 1000 << " ms (" << stats.packetsPerSecond() / 1e6 << " mln pakietów/s, "
+             << workers << " wątków)\n";
+        cout << "Rozkład przepływów (hash Toeplitza): najbardziej obciążony wątek ma " << stats.skew()
+             << "x średniej\n";
+        for (size_t i = 0; i < stats.perWorker.size(); ++i)
+            cout << "  wątek " << i << ": " << stats.perWorker[i] << " pakietów, najwyższa zajętość pierścienia "
+                 << stats.queuePeak[i] << "/" << stats.queueCapacity << "\n";
+        log << "FLOOD " << count << " pakietów, " << workers << " wątków, " << stats.packetsPerSecond() << " pakietów/s\n";
     }
 
     void handleSend(istringstream& ss) {
@@ -246,9 +5446,13 @@ private:
         Packet pkt(IPAddress(src), IPAddress(dst), proto);
         cout << pkt.toString() << endl;
 
-        auto r = table.findRoute(pkt.getDestination());
+        uint32_t h = flowHash.hash(pkt.getSource().getAddr(), pkt.getDestination().getAddr(), pkt.getProtocolNumber());
+        auto r = table.findRoute(pkt.getDestination(), h);
         if (r) {
-            cout << "Przekazuję pakiet przez bramę: " << r->getGateway().toString() << endl;
+            cout << "Przekazuję pakiet przez bramę: " << r->getGateway().toString();
+            if (!(r->getNextHop() == r->getGateway()))
+                cout << " (następny skok " << r->getNextHop().toString() << ")";
+            cout << endl;
             log << "FWD " << pkt.toString() << " przez " << r->getGateway().toString() << "\n";
         } else {
             cout << "Pakiet został odrzucony (brak odpowiedniej trasy).\n";
@@ -259,8 +5463,22 @@ private:
 
 
 
-int main() {
+// Bez main przy dołączaniu pliku przez testy (tests/RouterSimulatorTests.cpp)
+#ifndef ROUTER_NO_MAIN
+// Opcjonalny argument: migawka FIB otwierana przy starcie; bez niego stan jest odtwarzany
+// z punktu kontrolnego i dziennika zmian (router.journal)
+int main(int argc, char* argv[]) {
     RouterCLI cli;
+    try {
+        if (argc > 1)
+            cli.openSnapshot(argv[1]);
+        else
+            cli.recover();
+    } catch (const exception& e) {
+        cerr << "Błąd: " << e.what() << endl;
+        return 1;
+    }
     cli.run();
     return 0;
 }
+#endif
@@ -0,0 +1,942 @@
+// Testy symulatora routera. Plik dołącza RouterSimulator.cpp bez funkcji main, więc testy
+// widzą te same klasy co program. Kompilacja i uruchomienie (z katalogu repozytorium):
+//   g++ -std=c++17 -O2 -pthread tests/RouterSimulatorTests.cpp -o router_tests && ./router_tests [filtr]
+#define ROUTER_NO_MAIN
+#include "../RouterSimulator.cpp"
+
+// ------------------------- Framework -------------------------
+namespace {
+
+struct TestCase {
+    const char* name;
+    void (*run)();
+};
+
+vector<TestCase>& registry() {
+    static vector<TestCase> tests;
+    return tests;
+}
+
+struct Registrar {
+    Registrar(const char* name, void (*run)()) { registry().push_back({name, run}); }
+};
+
+size_t checks = 0;
+size_t failures = 0;
+
+void reportFailure(const char* file, int line, const string& what) {
+    ++failures;
+    cout << "  " << file << ":" << line << ": " << what << "\n";
+}
+
+}  // namespace
+
+#define TEST(name)                                        \
+    static void name();                                   \
+    static Registrar name##Registrar(#name, name);        \
+    static void name()
+
+#define CHECK(cond)                                                  \
+    do {                                                             \
+        ++checks;                                                    \
+        if (!(cond)) reportFailure(__FILE__, __LINE__, #cond);       \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                         \
+    do {                                                                                       \
+        ++checks;                                                                              \
+        auto checkA = (a);                                                                     \
+        auto checkB = (b);                                                                     \
+        if (!(checkA == checkB)) {                                                             \
+            ostringstream checkOss;                                                            \
+            checkOss << #a << " == " << #b << " (" << checkA << " != " << checkB << ")";       \
+            reportFailure(__FILE__, __LINE__, checkOss.str());                                 \
+        }                                                                                      \
+    } while (0)
+
+// ------------------------- LpmEngine -------------------------
+// Prefiksy skupione wokół kilku bloków, żeby się zagnieżdżały i trafiały do tablic drugiego
+// poziomu DIR-24-8 (prefiksy dłuższe niż /24)
+static vector<pair<uint32_t, int>> randomPrefixes(mt19937& rng, size_t n) {
+    static const uint32_t bases[] = {0x0A000000u, 0xC0A80000u, 0xAC100000u, 0x01020300u};
+    static const int lengths[] = {0, 1, 7, 8, 12, 16, 20, 23, 24, 25, 26, 28, 30, 31, 32};
+    vector<pair<uint32_t, int>> prefixes;
+    for (size_t i = 0; i < n; ++i) {
+        int len = lengths[rng() % size(lengths)];
+        uint32_t key = bases[rng() % size(bases)] ^ (rng() & 0x0003FFFFu);
+        prefixes.emplace_back(key & prefixMask(len), len);
+    }
+    return prefixes;
+}
+
+// Adresy testowe: losowe, z wnętrza bloków i z granic każdego prefiksu
+static vector<uint32_t> probeAddresses(mt19937& rng, const vector<pair<uint32_t, int>>& prefixes) {
+    vector<uint32_t> addrs = {0, 0xFFFFFFFFu};
+    for (const auto& p : prefixes) {
+        uint32_t last = p.first | ~prefixMask(p.second);
+        addrs.insert(addrs.end(), {p.first, last, p.first - 1, last + 1});
+    }
+    for (int i = 0; i < 2000; ++i) addrs.push_back(rng());
+    return addrs;
+}
+
+// Wszystkie silniki dają te same wyniki co przegląd liniowy: wyszukiwanie pojedyncze, wsadowe
+// na każdym obsługiwanym poziomie SIMD i dokładne dopasowanie, po wstawieniach, usunięciach
+// i przebudowie jednym przejściem (assign)
+TEST(enginesMatchLinearScan) {
+    SimdLevel detected = activeSimdLevel();
+    for (const string& name : lpmEngineNames()) {
+        if (name == "linear")
+            continue;
+        mt19937 rng(12345);
+        auto reference = makeLpmEngine("linear");
+        auto engine = makeLpmEngine(name);
+        auto prefixes = randomPrefixes(rng, 600);
+
+        auto compare = [&](const char* phase) {
+            auto addrs = probeAddresses(rng, prefixes);
+            size_t mismatches = 0;
+            for (uint32_t a : addrs)
+                if (engine->lookup(a) != reference->lookup(a)) ++mismatches;
+            for (const auto& p : prefixes)
+                if (engine->exact(p.first, p.second) != reference->exact(p.first, p.second)) ++mismatches;
+
+            vector<uint32_t> expected(addrs.size()), got(addrs.size());
+            reference->lookupBatch(addrs.data(), addrs.size(), expected.data());
+            for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+                if (level > detected)
+                    continue;
+                activeSimdLevel() = level;
+                engine->lookupBatch(addrs.data(), addrs.size(), got.data());
+                if (got != expected) ++mismatches;
+            }
+            activeSimdLevel() = detected;
+            if (mismatches > 0)
+                reportFailure(__FILE__, __LINE__, name + ": " + phase + ": " + to_string(mismatches) + " rozbieżności");
+            ++checks;
+            CHECK_EQ(engine->size(), reference->size());
+        };
+
+        for (size_t i = 0; i < prefixes.size(); ++i) {
+            engine->insert(prefixes[i].first, prefixes[i].second, static_cast<uint32_t>(i));
+            reference->insert(prefixes[i].first, prefixes[i].second, static_cast<uint32_t>(i));
+        }
+        compare("wstawienia");
+
+        for (size_t i = 0; i < prefixes.size(); i += 3) {
+            CHECK_EQ(engine->erase(prefixes[i].first, prefixes[i].second),
+                     reference->erase(prefixes[i].first, prefixes[i].second));
+        }
+        compare("usunięcia");
+
+        engine->assign(*reference);
+        compare("assign");
+    }
+}
+
+// ------------------------- LookupCache -------------------------
+// Statystyki pamięci podręcznej obejmują wyszukiwania wszystkich wątków, także zakończonych
+TEST(cacheStatsIncludeAllThreads) {
+    RoutingTable table;
+    table.addRoute(Route(IPAddress("10.0.0.0/8"), IPAddress("192.168.0.1"), 1));
+    LookupCacheStats before = LookupCacheRegistry::instance().totals();
+
+    const size_t threads = 4, lookups = 1000;
+    vector<thread> workers;
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&] {
+            for (size_t i = 0; i < lookups; ++i) table.findSlotCached(0x0A000000u + static_cast<uint32_t>(i % 10));
+        });
+    }
+    for (auto& w : workers) w.join();
+
+    LookupCacheStats after = LookupCacheRegistry::instance().totals();
+    CHECK_EQ(after.hits + after.misses - before.hits - before.misses, threads * lookups);
+    CHECK_EQ(after.misses - before.misses, threads * 10);
+}
+
+// ------------------------- Packet -------------------------
+TEST(protocolNamesIgnoreCase) {
+    CHECK_EQ(int(ipProtocolNumber("TCP")), 6);
+    CHECK_EQ(int(ipProtocolNumber("tcp")), 6);
+    CHECK_EQ(int(ipProtocolNumber("Udp")), 17);
+    CHECK_EQ(int(ipProtocolNumber("icmp")), 1);
+    CHECK_EQ(int(ipProtocolNumber("47")), 47);
+    CHECK_EQ(int(ipProtocolNumber("gre")), int(ipProtocolNumber("GRE")));
+    CHECK_EQ(int(ipProtocolNumber("\xC5\xBC")), int(ipProtocolNumber("\xC5\xBC")));   // bajty spoza ASCII
+}
+
+// ------------------------- Rings -------------------------
+// Stany pełny/pusty i wielokrotne przejście indeksów przez koniec bufora w jednym wątku
+template <class Ring>
+static void checkRingBoundaries() {
+    Ring ring(5);
+    CHECK_EQ(ring.capacity(), size_t(8));
+
+    uint32_t out[16];
+    CHECK_EQ(ring.dequeueBurst(out, 16), size_t(0));
+
+    uint32_t items[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    CHECK_EQ(ring.enqueueBurst(items, 10), size_t(8));
+    CHECK_EQ(ring.occupancy(), size_t(8));
+    CHECK_EQ(ring.enqueueBurst(items, 1), size_t(0));
+    CHECK_EQ(ring.rejectedCount(), uint64_t(3));
+    CHECK_EQ(ring.dequeueBurst(out, 16), size_t(8));
+    for (uint32_t i = 0; i < 8; ++i) CHECK_EQ(out[i], i);
+    CHECK_EQ(ring.dequeueBurst(out, 16), size_t(0));
+
+    // Paczki o długości względnie pierwszej z pojemnością dzielą się na granicy bufora
+    uint32_t next = 0, expected = 0;
+    size_t wrongOrder = 0;
+    for (int round = 0; round < 1000; ++round) {
+        uint32_t burst[5];
+        for (uint32_t& v : burst) v = next++;
+        size_t pushed = ring.enqueueBurst(burst, 5);
+        next -= static_cast<uint32_t>(5 - pushed);
+        size_t popped = ring.dequeueBurst(out, round % 2 ? 3 : 7);
+        for (size_t i = 0; i < popped; ++i)
+            if (out[i] != expected++) ++wrongOrder;
+    }
+    while (size_t popped = ring.dequeueBurst(out, 16))
+        for (size_t i = 0; i < popped; ++i)
+            if (out[i] != expected++) ++wrongOrder;
+    CHECK_EQ(wrongOrder, size_t(0));
+    CHECK_EQ(expected, next);
+    CHECK_EQ(ring.occupancy(), size_t(0));
+    CHECK_EQ(ring.enqueuedCount(), ring.dequeuedCount());
+}
+
+TEST(ringBoundaries) {
+    checkRingBoundaries<SpscRing<uint32_t>>();
+    checkRingBoundaries<MpscRing<uint32_t>>();
+}
+
+// Producent i konsument w osobnych wątkach przy małym pierścieniu (często pełnym i pustym)
+TEST(spscRingConcurrent) {
+    SpscRing<uint32_t> ring(64);
+    const uint32_t total = 200000;
+    thread producer([&] {
+        uint32_t burst[32];
+        for (uint32_t next = 0; next < total;) {
+            uint32_t n = min<uint32_t>(32, total - next);
+            for (uint32_t i = 0; i < n; ++i) burst[i] = next + i;
+            size_t pushed = ring.enqueueBurst(burst, n);
+            if (pushed == 0) this_thread::yield();
+            next += static_cast<uint32_t>(pushed);
+        }
+    });
+    uint32_t expected = 0;
+    size_t wrongOrder = 0;
+    uint32_t out[48];
+    while (expected < total) {
+        size_t popped = ring.dequeueBurst(out, 48);
+        if (popped == 0) this_thread::yield();
+        for (size_t i = 0; i < popped; ++i)
+            if (out[i] != expected++) ++wrongOrder;
+    }
+    producer.join();
+    CHECK_EQ(wrongOrder, size_t(0));
+    CHECK_EQ(ring.dequeueBurst(out, 48), size_t(0));
+    CHECK(ring.highWater() <= ring.capacity());
+}
+
+// Kilku producentów: żaden element nie ginie ani się nie powtarza, a elementy jednego
+// producenta przychodzą w jego kolejności
+TEST(mpscRingConcurrent) {
+    MpscRing<uint32_t> ring(64);
+    const uint32_t producers = 4, perProducer = 50000;
+    vector<thread> threads;
+    for (uint32_t p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p] {
+            uint32_t burst[16];
+            for (uint32_t next = 0; next < perProducer;) {
+                uint32_t n = min<uint32_t>(1 + next % 16, perProducer - next);
+                for (uint32_t i = 0; i < n; ++i) burst[i] = p << 24 | (next + i);
+                size_t pushed = ring.enqueueBurst(burst, n);
+                if (pushed == 0) this_thread::yield();
+                next += static_cast<uint32_t>(pushed);
+            }
+        });
+    }
+    vector<uint32_t> nextOf(producers, 0);
+    size_t wrongOrder = 0, received = 0;
+    uint32_t out[32];
+    while (received < size_t(producers) * perProducer) {
+        size_t popped = ring.dequeueBurst(out, 32);
+        if (popped == 0) this_thread::yield();
+        for (size_t i = 0; i < popped; ++i) {
+            uint32_t p = out[i] >> 24;
+            if (p >= producers || (out[i] & 0xFFFFFF) != nextOf[p]++) ++wrongOrder;
+        }
+        received += popped;
+    }
+    for (auto& t : threads) t.join();
+    CHECK_EQ(wrongOrder, size_t(0));
+    CHECK_EQ(ring.dequeueBurst(out, 32), size_t(0));
+    CHECK_EQ(ring.enqueuedCount(), uint64_t(producers) * perProducer);
+}
+
+// ------------------------- ToeplitzHash -------------------------
+// Wektory weryfikacyjne RSS z dokumentacji Microsoft (IPv4 bez portów - protokół 0 nic nie
+// zmienia w hashu) oraz zgodność wersji wektorowych ze skalarną dla liczby krotek, która nie
+// jest wielokrotnością szerokości wektora
+TEST(toeplitzHashMatchesRssVectors) {
+    ToeplitzHash rss;
+    CHECK_EQ(rss.hash(IPAddress("66.9.149.187").getAddr(), IPAddress("161.142.100.80").getAddr(), 0), 0x323e8fc2u);
+    CHECK_EQ(rss.hash(IPAddress("199.92.111.2").getAddr(), IPAddress("65.69.140.83").getAddr(), 0), 0xd718262au);
+
+    SimdLevel detected = activeSimdLevel();
+    mt19937 rng(12);
+    for (size_t n : {size_t(0), size_t(1), size_t(7), size_t(8), size_t(15), size_t(17), size_t(1000)}) {
+        vector<uint32_t> src(n), dst(n), proto(n), expected(n), got(n);
+        for (size_t i = 0; i < n; ++i) {
+            src[i] = rng();
+            dst[i] = rng();
+            proto[i] = rng() & 0xFF;
+            expected[i] = rss.hash(src[i], dst[i], static_cast<uint8_t>(proto[i]));
+        }
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::Avx2, SimdLevel::Avx512}) {
+            if (level > detected)
+                continue;
+            activeSimdLevel() = level;
+            fill(got.begin(), got.end(), 0);
+            rss.hashBatch(src.data(), dst.data(), proto.data(), n, got.data());
+            if (got != expected)
+                reportFailure(__FILE__, __LINE__, string(simdLevelName(level)) + ": n = " + to_string(n));
+            ++checks;
+        }
+        activeSimdLevel() = detected;
+    }
+}
+
+// ------------------------- LeftRight -------------------------
+// Czytelnicy nigdy nie widzą kopii w trakcie zmiany ani cofnięcia się wersji, a po modify
+// obie kopie mają ten sam stan
+TEST(leftRightReadersSeeConsistentState) {
+    struct Pair {
+        uint64_t first = 0, second = 0;
+    };
+    LeftRight<Pair> lr;
+    const uint64_t writes = 20000;
+    atomic<bool> done{false};
+    atomic<size_t> torn{0}, backwards{0};
+    vector<thread> readers;
+    for (int r = 0; r < 3; ++r) {
+        readers.emplace_back([&] {
+            uint64_t last = 0;
+            while (!done.load()) {
+                Pair seen = lr.read([](const Pair& p) { return p; });
+                if (seen.first != seen.second) ++torn;
+                if (seen.first < last) ++backwards;
+                last = seen.first;
+                this_thread::yield();
+            }
+        });
+    }
+    for (uint64_t i = 1; i <= writes; ++i) {
+        lr.modify([&](Pair& p) {
+            p.first = i;
+            this_thread::yield();
+            p.second = i;
+        });
+        CHECK_EQ(lr.read([](const Pair& p) { return p.first; }), i);
+    }
+    done = true;
+    for (auto& t : readers) t.join();
+    CHECK_EQ(torn.load(), size_t(0));
+    CHECK_EQ(backwards.load(), size_t(0));
+    CHECK_EQ(lr.updateCount(), writes);
+
+    // Kolejne modify działa na drugiej kopii, która musi już zawierać poprzednią zmianę
+    lr.modify([](Pair& p) { p.second += 1; });
+    lr.modify([](Pair& p) { p.first += 1; });
+    Pair last = lr.read([](const Pair& p) { return p; });
+    CHECK_EQ(last.first, writes + 1);
+    CHECK_EQ(last.second, writes + 1);
+}
+
+// Wyszukiwania w tablicy równoległe z dodawaniem i usuwaniem tras: stała trasa zawsze jest
+// znajdowana, a zmienna albo istnieje w całości, albo jej nie ma
+TEST(routingTableConcurrentReads) {
+    const IPAddress stableNet("10.0.0.0/8"), stableGw("192.168.1.1");
+    const IPAddress churnNet("20.0.0.0/8"), churnGw("192.168.1.2");
+    const IPAddress stableDst("10.1.2.3"), churnDst("20.1.2.3");
+    RoutingTable table;
+    table.addRoute(Route(stableNet, stableGw, 5));
+    atomic<bool> done{false};
+    atomic<size_t> lost{0}, wrong{0};
+    vector<thread> readers;
+    for (int r = 0; r < 2; ++r) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                optional<Route> stable = table.findRoute(stableDst);
+                if (!stable || !(stable->getGateway() == stableGw)) ++lost;
+                optional<Route> churn = table.findRoute(churnDst);
+                if (churn && !(churn->getGateway() == churnGw)) ++wrong;
+                this_thread::yield();
+            }
+        });
+    }
+    for (int i = 0; i < 500; ++i) {
+        table.addRoute(Route(churnNet, churnGw, 3));
+        this_thread::yield();
+        table.removeRoute(churnNet);
+        this_thread::yield();
+    }
+    done = true;
+    for (auto& t : readers) t.join();
+    CHECK_EQ(lost.load(), size_t(0));
+    CHECK_EQ(wrong.load(), size_t(0));
+    CHECK(!table.findRoute(churnDst));
+    CHECK(table.findRoute(stableDst).has_value());
+}
+
+// ------------------------- ECMP -------------------------
+// Kubełki rozdzielone po równo, a dodanie lub usunięcie członka przenosi tylko te przepływy,
+// które muszą się przenieść
+TEST(ecmpGroupBucketsAndFlowStability) {
+    const uint32_t flows = 4096;
+    auto spread = [&](const NextHopGroup& g) {
+        vector<uint32_t> chosen(flows);
+        for (uint32_t f = 0; f < flows; ++f) chosen[f] = g.select(f * 0x9E3779B9u);
+        return chosen;
+    };
+
+    NextHopGroup g;
+    for (uint32_t slot = 10; slot < 14; ++slot) g.add(slot);
+    map<uint32_t, size_t> owned;
+    for (uint16_t b : g.bucketTable()) ++owned[g.slots()[b]];
+    CHECK_EQ(owned.size(), size_t(4));
+    for (auto& [slot, count] : owned) CHECK_EQ(count, g.bucketCount() / 4);
+
+    vector<uint32_t> before = spread(g);
+    set<uint32_t> used(before.begin(), before.end());
+    CHECK_EQ(used.size(), size_t(4));
+    CHECK(before == spread(g));
+
+    g.add(14);
+    vector<uint32_t> grown = spread(g);
+    size_t moved = 0;
+    for (uint32_t f = 0; f < flows; ++f) {
+        if (grown[f] == before[f]) continue;
+        ++moved;
+        CHECK_EQ(grown[f], uint32_t(14));
+    }
+    CHECK(moved > 0 && moved < flows / 3);
+
+    // Usunięcie członka 11: przenoszą się wyłącznie jego przepływy
+    size_t at = find(g.slots().begin(), g.slots().end(), 11u) - g.slots().begin();
+    g.removeAt(at);
+    vector<uint32_t> shrunk = spread(g);
+    for (uint32_t f = 0; f < flows; ++f) {
+        CHECK(shrunk[f] != 11u);
+        if (grown[f] != 11u) CHECK_EQ(shrunk[f], grown[f]);
+    }
+}
+
+// Trasy o równej metryce tworzą grupę: przepływ trzyma się bramy, ruch trafia na wszystkie
+// bramy, a awaria jednej przenosi tylko jej przepływy
+TEST(ecmpRoutesInTable) {
+    const IPAddress net("10.0.0.0/8");
+    const IPAddress gw[3] = {IPAddress("192.168.1.1"), IPAddress("192.168.1.2"), IPAddress("192.168.1.3")};
+    RoutingTable table;
+    for (const IPAddress& g : gw) table.addRoute(Route(net, g, 5));
+    table.addRoute(Route(net, IPAddress("192.168.1.9"), 7));
+
+    const IPAddress dst("10.1.2.3");
+    const uint32_t flows = 1024;
+    vector<uint32_t> before(flows);
+    map<uint32_t, size_t> perGateway;
+    for (uint32_t f = 0; f < flows; ++f) {
+        optional<Route> r = table.findRoute(dst, f * 0x9E3779B9u);
+        CHECK(r.has_value());
+        if (!r) return;
+        before[f] = r->getGateway().getAddr();
+        ++perGateway[before[f]];
+        CHECK_EQ(table.findRoute(dst, f * 0x9E3779B9u)->getGateway().getAddr(), before[f]);
+    }
+    CHECK_EQ(perGateway.size(), size_t(3));
+    for (const IPAddress& g : gw) CHECK(perGateway[g.getAddr()] > flows / 6);
+
+    table.setGatewayUp(gw[1], false);
+    for (uint32_t f = 0; f < flows; ++f) {
+        uint32_t now = table.findRoute(dst, f * 0x9E3779B9u)->getGateway().getAddr();
+        CHECK(now != gw[1].getAddr());
+        CHECK(now != IPAddress("192.168.1.9").getAddr());
+        if (before[f] != gw[1].getAddr()) CHECK_EQ(now, before[f]);
+    }
+
+    table.setGatewayUp(gw[1], true);
+    for (uint32_t f = 0; f < flows; ++f)
+        CHECK_EQ(table.findRoute(dst, f * 0x9E3779B9u)->getGateway().getAddr(), before[f]);
+
+    // Usunięcie członka z grupy nie przenosi przepływów pozostałych bram
+    CHECK(table.removeRoute(net, gw[0]));
+    for (uint32_t f = 0; f < flows; ++f) {
+        uint32_t now = table.findRoute(dst, f * 0x9E3779B9u)->getGateway().getAddr();
+        CHECK(now != gw[0].getAddr());
+        if (before[f] != gw[0].getAddr()) CHECK_EQ(now, before[f]);
+    }
+}
+
+// ------------------------- Gateways -------------------------
+// Przepięcie bramy na adres, który już jest bramą tego samego prefiksu, zostawia jedną trasę:
+// lepszą, a przy równej metryce dotychczasową
+TEST(gatewayMoveOntoExistingMember) {
+    const IPAddress a("192.168.1.1"), b("192.168.1.2");
+    const IPAddress tie("10.0.0.0/8"), better("20.0.0.0/8"), worse("30.0.0.0/8"), single("40.0.0.0/8");
+    RoutingTable table;
+    table.addRoute(Route(tie, a, 5));
+    table.addRoute(Route(tie, b, 5));
+    table.addRoute(Route(better, a, 3));
+    table.addRoute(Route(better, b, 7));
+    table.addRoute(Route(worse, a, 9));
+    table.addRoute(Route(worse, b, 4));
+    table.addRoute(Route(single, a, 6));
+
+    CHECK(table.repointGateway(a, b));
+    CHECK(table.routesVia(a).empty());
+    map<uint32_t, int> metricOf;
+    size_t count = 0;
+    for (const Route& r : table.routesVia(b)) {
+        metricOf[r.getNetwork().getAddr()] = r.getMetric();
+        ++count;
+    }
+    CHECK_EQ(count, size_t(4));
+    CHECK_EQ(metricOf[tie.getAddr()], 5);
+    CHECK_EQ(metricOf[better.getAddr()], 3);
+    CHECK_EQ(metricOf[worse.getAddr()], 4);
+    CHECK_EQ(metricOf[single.getAddr()], 6);
+
+    for (uint32_t f = 0; f < 256; ++f)
+        CHECK(table.findRoute(IPAddress("10.1.2.3"), f * 0x9E3779B9u)->getGateway() == b);
+
+    // Jedyna trasa prefiksu usunięta przez bramę usuwa cały prefiks - nic nie zostało zdublowane
+    CHECK(table.removeRoute(tie, b));
+    CHECK(!table.hasRoute(tie));
+    CHECK(!table.repointGateway(a, b));
+}
+
+// Po awarii bram dwóch najlepszych tras ruch przechodzi na trzecią, także w otwartej migawce
+TEST(failoverFallsThroughBackups) {
+    const IPAddress net("100.0.0.0/8"), dst("100.1.2.3");
+    const IPAddress gw1("1.0.0.1"), gw2("1.0.0.2"), gw3("1.0.0.3");
+    RoutingTable table;
+    table.addRoute(Route(net, gw1, 5));
+    table.addRoute(Route(net, gw2, 9));
+    table.addRoute(Route(net, gw3, 12));
+
+    CHECK(table.findRoute(dst)->getGateway() == gw1);
+    table.setGatewayUp(gw1, false);
+    CHECK(table.findRoute(dst)->getGateway() == gw2);
+    table.setGatewayUp(gw2, false);
+    optional<Route> last = table.findRoute(dst);
+    CHECK(last.has_value());
+    CHECK(last && last->getGateway() == gw3);
+
+    string path = "/tmp/router_tests_failover." + to_string(::getpid());
+    table.save(path);
+    RoutingTable reopened;
+    reopened.open(path);
+    last = reopened.findRoute(dst);
+    CHECK(last.has_value());
+    CHECK(last && last->getGateway() == gw3);
+    ::remove(path.c_str());
+
+    table.setGatewayUp(gw3, false);
+    CHECK(!table.findRoute(dst));
+    table.setGatewayUp(gw2, true);
+    CHECK(table.findRoute(dst)->getGateway() == gw2);
+}
+
+// Brama rozwiązywana przez prefiks ECMP przechodzi na działającego członka grupy, a zmiana
+// stanu dowolnego członka przelicza rozwiązanie
+TEST(recursiveResolutionSkipsDownMembers) {
+    const IPAddress gw1("192.168.1.1"), gw2("192.168.1.2"), dst("20.1.2.3");
+    RoutingTable table;
+    table.addRoute(Route(IPAddress("192.168.1.0/24"), IPAddress("192.168.1.254"), 1));
+    table.addRoute(Route(IPAddress("10.0.0.0/8"), gw1, 5));
+    table.addRoute(Route(IPAddress("10.0.0.0/8"), gw2, 5));
+    table.addRoute(Route(IPAddress("20.0.0.0/8"), IPAddress("10.1.1.1"), 3));
+    CHECK(table.findRoute(dst)->getNextHop() == gw1);
+
+    table.setGatewayUp(gw1, false);
+    optional<Route> r = table.findRoute(dst);
+    CHECK(r.has_value());
+    CHECK(r && r->getNextHop() == gw2);
+    CHECK(table.findRoute(IPAddress("10.1.2.3"))->getGateway() == gw2);
+
+    table.setGatewayUp(gw1, true);
+    CHECK(table.findRoute(dst)->getNextHop() == gw1);
+    table.setGatewayUp(gw1, false);
+    table.setGatewayUp(gw2, false);
+    CHECK(!table.findRoute(dst));
+    table.setGatewayUp(gw2, true);
+    r = table.findRoute(dst);
+    CHECK(r && r->getNextHop() == gw2);
+}
+
+// ------------------------- Parser -------------------------
+// Wersja wektorowa daje te same wyniki co skalarna, także dla adresów kończących bufor
+// (bez 16 bajtów do przeczytania) i dla błędnych adresów
+TEST(parserMatchesScalar) {
+    mt19937 rng(21);
+    const char alphabet[] = "0123456789...x";
+    vector<string> texts;
+    for (int i = 0; i < 2000; ++i) texts.push_back(IPAddress(static_cast<uint32_t>(rng()), 32).toString().substr(0, 15));
+    for (string& s : texts) s.resize(s.find('/') == string::npos ? s.size() : s.find('/'));
+    for (int i = 0; i < 2000; ++i) {
+        string s(1 + rng() % 16, '0');
+        for (char& c : s) c = alphabet[rng() % (sizeof(alphabet) - 1)];
+        texts.push_back(s);
+    }
+    texts.push_back("255.255.255.255");
+    texts.push_back("256.1.1.1");
+    texts.push_back("1.2.3.4");
+
+    string buffer;
+    for (const string& s : texts) buffer += s + '\n';
+    const char* limit = buffer.data() + buffer.size();
+    size_t mismatches = 0, pos = 0;
+    for (const string& s : texts) {
+        string_view inBuffer(buffer.data() + pos, s.size());
+        pos += s.size() + 1;
+        uint32_t expected = 0, got = 0, alone = 0;
+        ParseError want = parseIPv4Scalar(s, expected);
+        // Osobna alokacja o długości tekstu - wczytanie 16 bajtów wyszłoby poza nią
+        unique_ptr<char[]> exact(new char[s.size()]);
+        memcpy(exact.get(), s.data(), s.size());
+        if (parseIPv4(inBuffer, got, limit) != want || got != expected) ++mismatches;
+        if (parseIPv4(string_view(exact.get(), s.size()), alone, exact.get() + s.size()) != want || alone != expected)
+            ++mismatches;
+    }
+    CHECK_EQ(mismatches, size_t(0));
+
+    Route route(IPAddress(0, 0), IPAddress(0, 32), 0);
+    string line = "10.0.0.0/8 192.168.1.1 5";
+    CHECK(parseRouteLine(line, route) == ParseError::None);
+    CHECK(route.getGateway() == IPAddress("192.168.1.1"));
+    CHECK_EQ(route.getNetwork().getPrefix(), 8);
+}
+
+// ------------------------- Bulk -------------------------
+// Wczytywanie paczkami (duże z przebudową silnika, małe wstawieniami, puste) daje tę samą
+// tablicę co pojedyncze dodawanie tras, w obu kopiach Left-Right
+TEST(bulkBatchesMatchSingleAdds) {
+    mt19937 rng(22);
+    vector<pair<uint32_t, int>> prefixes = randomPrefixes(rng, 1000);
+    vector<Route> all;
+    for (const auto& p : prefixes) {
+        // Bramy także wewnątrz bloków z prefiksami - rozwiązywane rekurencyjnie
+        uint32_t gateway = rng() % 4 ? 0x0A000000u | (rng() & 0x3FFFF) : 0xC0A80001u + rng() % 8;
+        all.emplace_back(IPAddress(p.first, p.second), IPAddress(gateway, 32), static_cast<int>(rng() % 4));
+    }
+
+    RoutingTable single, bulk;
+    for (const Route& r : all) single.addRoute(r);
+    const size_t sizes[] = {400, 0, 7, 1, 0, 100, 50, 442};
+    size_t next = 0;
+    for (size_t n : sizes) {
+        CHECK_EQ(bulk.addRoutes(vector<Route>(all.begin() + next, all.begin() + next + n)), size_t(0));
+        next += n;
+    }
+    CHECK_EQ(next, all.size());
+
+    vector<uint32_t> probes = probeAddresses(rng, prefixes);
+    auto compare = [&] {
+        size_t mismatches = 0;
+        CHECK_EQ(bulk.size(), single.size());
+        for (uint32_t addr : probes) {
+            for (uint32_t flow : {0u, 0x9E3779B9u}) {
+                optional<Route> a = single.findRoute(IPAddress(addr, 32), flow);
+                optional<Route> b = bulk.findRoute(IPAddress(addr, 32), flow);
+                if (a.has_value() != b.has_value()) ++mismatches;
+                else if (a && !(a->getGateway() == b->getGateway() && a->getNextHop() == b->getNextHop()
+                                 && a->getMetric() == b->getMetric()))
+                    ++mismatches;
+            }
+        }
+        for (const auto& p : prefixes)
+            if (bulk.hasRoute(IPAddress(p.first, p.second)) != single.hasRoute(IPAddress(p.first, p.second)))
+                ++mismatches;
+        CHECK_EQ(mismatches, size_t(0));
+    };
+    compare();
+
+    // Kolejna zmiana przełącza czytelników na drugą kopię, uzupełnioną kopią lub powtórzeniem wsadu
+    const IPAddress extra("203.0.113.0/24"), extraGw("198.51.100.1");
+    single.addRoute(Route(extra, extraGw, 1));
+    bulk.addRoute(Route(extra, extraGw, 1));
+    compare();
+    for (size_t i = 0; i < prefixes.size(); i += 3) {
+        single.removeRoute(IPAddress(prefixes[i].first, prefixes[i].second));
+        bulk.removeRoute(IPAddress(prefixes[i].first, prefixes[i].second));
+    }
+    compare();
+}
+
+// ------------------------- MRT -------------------------
+// Mały zrzut TABLE_DUMP_V2: tabela sąsiadów, wpisy RIB z NEXT_HOP, z MP_REACH_NLRI i bez
+// następnego skoku, wpisy ADD-PATH, rekord innego typu, uszkodzona lista atrybutów i plik
+// urwany w połowie rekordu
+TEST(mrtImportBuildsTable) {
+    using Bytes = vector<uint8_t>;
+    auto be16 = [](Bytes& b, uint32_t v) { b.push_back(uint8_t(v >> 8)); b.push_back(uint8_t(v)); };
+    auto be32 = [&](Bytes& b, uint32_t v) { be16(b, v >> 16); be16(b, v & 0xFFFF); };
+    auto record = [&](Bytes& file, uint16_t type, uint16_t subtype, const Bytes& body) {
+        be32(file, 1700000000);
+        be16(file, type);
+        be16(file, subtype);
+        be32(file, static_cast<uint32_t>(body.size()));
+        file.insert(file.end(), body.begin(), body.end());
+    };
+    auto attribute = [&](Bytes& b, uint8_t flags, uint8_t type, const Bytes& value) {
+        b.push_back(flags);
+        b.push_back(type);
+        if (flags & 0x10) be16(b, static_cast<uint32_t>(value.size()));
+        else b.push_back(static_cast<uint8_t>(value.size()));
+        b.insert(b.end(), value.begin(), value.end());
+    };
+    // Segmenty AS_PATH: (typ, numery AS) - 2 to AS_SEQUENCE, 1 to AS_SET
+    auto asPath = [&](Bytes& b, const vector<pair<uint8_t, vector<uint32_t>>>& segments, uint8_t flags = 0x40) {
+        Bytes value;
+        for (const auto& segment : segments) {
+            value.push_back(segment.first);
+            value.push_back(static_cast<uint8_t>(segment.second.size()));
+            for (uint32_t as : segment.second) be32(value, as);
+        }
+        attribute(b, flags, 2, value);
+    };
+    auto nextHop = [&](Bytes& b, const char* addr) {
+        Bytes value;
+        be32(value, IPAddress(addr).getAddr());
+        attribute(b, 0x40, 3, value);
+    };
+    auto mpReach = [&](Bytes& b, const char* addr) {
+        Bytes value{4};
+        be32(value, IPAddress(addr).getAddr());
+        attribute(b, 0x80, 14, value);
+    };
+    auto entry = [&](Bytes& b, uint16_t peer, const Bytes& attributes, bool addPath = false) {
+        be16(b, peer);
+        be32(b, 1700000000);
+        if (addPath) be32(b, 7);
+        be16(b, static_cast<uint32_t>(attributes.size()));
+        b.insert(b.end(), attributes.begin(), attributes.end());
+    };
+    auto rib = [&](const char* network, const vector<Bytes>& entries) {
+        IPAddress net(network);
+        Bytes body;
+        be32(body, 1);
+        body.push_back(static_cast<uint8_t>(net.getPrefix()));
+        for (int i = 0; i < (net.getPrefix() + 7) / 8; ++i) body.push_back(uint8_t(net.getAddr() >> (24 - 8 * i)));
+        be16(body, static_cast<uint32_t>(entries.size()));
+        for (const Bytes& e : entries) body.insert(body.end(), e.begin(), e.end());
+        return body;
+    };
+
+    Bytes file;
+    Bytes peers;
+    be32(peers, IPAddress("10.255.0.1").getAddr());
+    be16(peers, 0);   // bez nazwy widoku
+    be16(peers, 3);
+    peers.push_back(0x02);   // IPv4, AS 4-bajtowy
+    be32(peers, 1); be32(peers, IPAddress("172.16.0.1").getAddr()); be32(peers, 65001);
+    peers.push_back(0x00);   // IPv4, AS 2-bajtowy
+    be32(peers, 2); be32(peers, IPAddress("172.16.0.2").getAddr()); be16(peers, 65002);
+    peers.push_back(0x03);   // IPv6
+    be32(peers, 3); peers.insert(peers.end(), 16, 0x20); be32(peers, 65003);
+    record(file, MrtRecord::TABLE_DUMP_V2, MrtRecord::PEER_INDEX_TABLE, peers);
+
+    // 10.0.0.0/8: brama 192.0.2.1 dwa razy (zostaje lepsza), 192.0.2.2 z MP_REACH_NLRI i AS_SET
+    // liczonym jako jeden AS, 192.0.2.3 ponad limit ścieżek, sąsiad IPv6 bez następnego skoku
+    vector<Bytes> entries(5);
+    nextHop(entries[0], "192.0.2.1"); asPath(entries[0], {{2, {100}}});
+    nextHop(entries[1], "192.0.2.1"); asPath(entries[1], {{2, {100, 200}}});
+    mpReach(entries[2], "192.0.2.2"); asPath(entries[2], {{2, {100, 200}}, {1, {1, 2, 3}}});
+    nextHop(entries[3], "192.0.2.3"); asPath(entries[3], {{2, {1, 2, 3, 4}}});
+    asPath(entries[4], {{2, {1}}});
+    vector<Bytes> ribEntries(5);
+    uint16_t entryPeers[] = {0, 1, 0, 1, 2};
+    for (size_t i = 0; i < 5; ++i) entry(ribEntries[i], entryPeers[i], entries[i]);
+    record(file, MrtRecord::TABLE_DUMP_V2, MrtRecord::RIB_IPV4_UNICAST, rib("10.0.0.0/8", ribEntries));
+
+    // ADD-PATH: nagłówek wpisu z identyfikatorem ścieżki; brama z adresu sąsiada, gdy brak NEXT_HOP
+    Bytes withPeerAddress, withExtendedLength;
+    asPath(withPeerAddress, {{2, {7, 8}}});
+    nextHop(withExtendedLength, "192.0.2.9");
+    asPath(withExtendedLength, {{2, {7}}}, 0x50);
+    vector<Bytes> addPathEntries(2);
+    entry(addPathEntries[0], 1, withPeerAddress, true);
+    entry(addPathEntries[1], 0, withExtendedLength, true);
+    record(file, MrtRecord::TABLE_DUMP_V2, MrtRecord::RIB_IPV4_UNICAST_ADDPATH, rib("198.51.100.0/24", addPathEntries));
+
+    record(file, 16, 4, Bytes(20, 0));   // BGP4MP - pomijany
+
+    // Atrybut deklaruje więcej bajtów, niż ma lista
+    Bytes broken{0x40, 3, 8, 192, 0, 2, 7};
+    vector<Bytes> brokenEntries(1);
+    entry(brokenEntries[0], 0, broken);
+    record(file, MrtRecord::TABLE_DUMP_V2, MrtRecord::RIB_IPV4_UNICAST, rib("203.0.113.0/24", brokenEntries));
+    size_t completeBytes = file.size();
+
+    Bytes cut;
+    record(cut, MrtRecord::TABLE_DUMP_V2, MrtRecord::RIB_IPV4_UNICAST, rib("192.0.2.0/24", ribEntries));
+    file.insert(file.end(), cut.begin(), cut.begin() + 20);
+
+    string path = "/tmp/router_tests_mrt." + to_string(::getpid());
+    {
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write(reinterpret_cast<const char*>(file.data()), static_cast<streamsize>(file.size()));
+    }
+    RoutingTable table;
+    MrtImportStats stats = importMrtFile(path, table, 2);
+    ::remove(path.c_str());
+
+    CHECK_EQ(stats.records, size_t(5));
+    CHECK_EQ(stats.otherRecords, size_t(1));
+    CHECK_EQ(stats.malformed, size_t(1));
+    CHECK_EQ(stats.prefixes, size_t(2));
+    CHECK_EQ(stats.entries, size_t(7));
+    CHECK_EQ(stats.noNextHop, size_t(1));
+    CHECK_EQ(stats.routes, size_t(4));
+    CHECK_EQ(stats.skipped, size_t(0));
+    CHECK_EQ(stats.bytes, completeBytes);
+    CHECK(stats.truncated);
+
+    CHECK_EQ(table.size(), size_t(4));
+    optional<Route> r = table.findRoute(IPAddress("10.1.2.3"));
+    CHECK(r && r->getGateway() == IPAddress("192.0.2.1") && r->getMetric() == 1);
+    vector<Route> via = table.routesVia(IPAddress("192.0.2.2"));
+    CHECK_EQ(via.size(), size_t(1));
+    CHECK(!via.empty() && via[0].getMetric() == 3);
+    CHECK(table.routesVia(IPAddress("192.0.2.3")).empty());
+
+    r = table.findRoute(IPAddress("198.51.100.7"));
+    CHECK(r && r->getGateway() == IPAddress("192.0.2.9") && r->getMetric() == 1);
+    via = table.routesVia(IPAddress("172.16.0.2"));
+    CHECK_EQ(via.size(), size_t(1));
+    CHECK(!via.empty() && via[0].getMetric() == 2);
+    CHECK(!table.hasRoute(IPAddress("203.0.113.0/24")));
+    CHECK(!table.hasRoute(IPAddress("192.0.2.0/24")));
+}
+
+// ------------------------- RouteJournal -------------------------
+// Tablica odtworzona z punktu kontrolnego i dziennika zgadza się z tablicą, na której zmiany
+// wykonywano na bieżąco - także po przeniesieniach i awariach bram oraz dla tras rozwiązywanych
+// rekurencyjnie przez trasy zapasowe o równej metryce
+TEST(journalRecoveryMatchesLiveTable) {
+    string journalPath = "/tmp/router_tests_journal." + to_string(::getpid());
+    string checkpointPrefix = "/tmp/router_tests_checkpoint." + to_string(::getpid());
+    string snapshotPath = "/tmp/router_tests_journal_snapshot." + to_string(::getpid());
+    auto cleanup = [&] {
+        ::remove(journalPath.c_str());
+        ::remove(snapshotPath.c_str());
+        for (const auto& entry : filesystem::directory_iterator("/tmp"))
+            if (entry.path().string().rfind(checkpointPrefix + ".", 0) == 0)
+                filesystem::remove(entry.path());
+    };
+    cleanup();
+
+    vector<uint32_t> gateways;
+    for (uint32_t i = 1; i <= 6; ++i) gateways.push_back(0xC0A80001 + (i << 8));   // 192.168.i.1
+    for (uint32_t i = 0; i < 3; ++i) gateways.push_back(0x0A000505 + (i << 16));   // 10.i.5.5
+    vector<pair<uint32_t, uint8_t>> networks{{0, 0}};
+    for (uint32_t i = 0; i < 6; ++i) networks.emplace_back(0x0A000000 + (i << 16), 16);
+    for (uint32_t i = 0; i < 9; ++i) networks.emplace_back(0x0A000000 + ((i / 3) << 16) + ((i % 3) << 8), 24);
+
+    mt19937 rng(25);
+    auto randomRecord = [&] {
+        JournalRecord r;
+        auto net = networks[rng() % networks.size()];
+        r.network = net.first;
+        r.prefix = net.second;
+        r.gateway = gateways[rng() % gateways.size()];
+        r.metric = static_cast<int32_t>(1 + rng() % 5);
+        unsigned kind = rng() % 20;
+        if (kind < 10) r.op = JournalRecord::Op::Add;
+        else if (kind < 13) r.op = JournalRecord::Op::RemoveVia;
+        else if (kind < 14) r.op = JournalRecord::Op::Remove;
+        else if (kind < 16) { r.op = JournalRecord::Op::GatewayMove; r.network = gateways[rng() % gateways.size()]; }
+        else if (kind < 18) r.op = JournalRecord::Op::GatewayDown;
+        else r.op = JournalRecord::Op::GatewayUp;
+        return r;
+    };
+
+    RoutingTable live;
+    {
+        RouteJournal journal(journalPath, checkpointPrefix);
+        journal.recover(live);
+        for (int step = 0; step < 1200; ++step) {
+            JournalRecord r = randomRecord();
+            journal.append(r);
+            r.apply(live);
+            if (step == 400 || step == 900)
+                journal.checkpoint(live);
+            if (step == 1000) {
+                // Otwarcie migawki trafia do dziennika jako ścieżka i jest powtarzane przez open
+                live.save(snapshotPath);
+                JournalRecord open{JournalRecord::Op::Open};
+                open.path = snapshotPath;
+                journal.append(open);
+                live.open(snapshotPath);
+            }
+        }
+        CHECK_EQ(journal.pendingChanges(), uint64_t(300));
+    }
+
+    RoutingTable recovered;
+    RouteJournal journal(journalPath, checkpointPrefix);
+    RecoveryStats stats = journal.recover(recovered);
+    CHECK(!stats.checkpoint.empty());
+    CHECK_EQ(stats.replayed, size_t(300));
+    CHECK_EQ(stats.failed, size_t(0));
+    CHECK(!stats.missingChanges);
+    CHECK_EQ(stats.droppedBytes, size_t(0));
+    CHECK_EQ(recovered.size(), live.size());
+
+    auto contents = [](const RoutingTable& table) {
+        vector<tuple<uint32_t, int, uint32_t, int>> routes;
+        vector<uint32_t> down;
+        table.forEachRoute([&](uint32_t network, int prefix, uint32_t gateway, int metric) {
+                               routes.emplace_back(network, prefix, gateway, metric);
+                           },
+                           [&](uint32_t gateway) { down.push_back(gateway); });
+        sort(routes.begin(), routes.end());
+        sort(down.begin(), down.end());
+        return make_pair(routes, down);
+    };
+    CHECK(contents(recovered) == contents(live));
+
+    size_t mismatches = 0;
+    for (const auto& net : networks) {
+        for (uint32_t host : {1u, 0x205u, 0x10203u}) {
+            IPAddress dst(net.first + host, 32);
+            optional<Route> a = live.findRoute(dst), b = recovered.findRoute(dst);
+            if (a.has_value() != b.has_value()
+                || (a && !(a->getGateway() == b->getGateway() && a->getNextHop() == b->getNextHop())))
+                ++mismatches;
+        }
+    }
+    CHECK_EQ(mismatches, size_t(0));
+    cleanup();
+}
+
+// ------------------------- main -------------------------
+int main(int argc, char* argv[]) {
+    string filter = argc > 1 ? argv[1] : "";
+    size_t run = 0, failed = 0;
+    for (const TestCase& test : registry()) {
+        if (!filter.empty() && string(test.name).find(filter) == string::npos)
+            continue;
+        size_t before = failures;
+        auto start = chrono::steady_clock::now();
+        test.run();
+        ++run;
+        bool ok = failures == before;
+        if (!ok) ++failed;
+        cout << (ok ? "OK    " : "BŁĄD  ") << test.name << " (" << secondsSince(start) * 1000 << " ms)\n";
+    }
+    cout << run << " testów, " << checks << " sprawdzeń, " << failed << " nieudanych\n";
+    return failed == 0 ? 0 : 1;
+}